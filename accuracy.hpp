@@ -0,0 +1,38 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: accuracy.hpp
+// Description: Build-time choice between throughput and timing accuracy
+//
+// The CPU, GPU, MMU and timer check Accuracy with if constexpr, so the fast
+// build has none of the extra timing work compiled in. Build with GB_ACCURATE
+// (make accurate) to debug timing-sensitive ROMs.
+
+#ifndef GB_ACCURACY
+#define GB_ACCURACY
+
+struct FastPolicy {
+  // Memory accesses see the timer and LCD registers as they are at the start
+  // of the instruction
+  static constexpr bool memoryTiming = false;
+
+  // Mode 3 is always 172 cycles
+  static constexpr bool fifoTiming = false;
+};
+
+struct AccuratePolicy {
+  // Memory accesses see the timer and LCD registers in the last M-cycle of
+  // the instruction, where the read or write happens. Superinstructions are
+  // left out, since they run two instructions' accesses at once.
+  static constexpr bool memoryTiming = true;
+
+  // Mode 3 is lengthened by the pixel FIFO stalls for SCX, the window and
+  // each sprite on the line, and hblank shortened to match
+  static constexpr bool fifoTiming = true;
+};
+
+#ifdef GB_ACCURATE
+typedef AccuratePolicy Accuracy;
+#else
+typedef FastPolicy Accuracy;
+#endif
+
+#endif
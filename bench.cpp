@@ -0,0 +1,345 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: bench.cpp
+// Description: Headless interpreter benchmark
+//
+// Runs the core without the SDL/ImGui frontend and reports instructions per
+// second.
+// Usage: gb_bench [program|rom.gb] [instructions] [jit] [noidle] [nofuse]
+//        [nobulk]
+//        gb_bench check [frames]
+//
+// check runs each built-in program with and without superinstructions and
+// fails if they end up in different states.
+//
+// Built with GB_PROFILE_PAIRS (make profile) it also writes the instruction
+// pairs that ran most often to superinstructions.hpp.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include "gameboy.hpp"
+
+// Built-in workloads, assembled at 0x150. Each one loops forever.
+struct program {
+  const char *name;
+  std::vector<u8> code;
+};
+
+const program programs[] = {
+    // Block copy, an ALU/CB mix, and a call/push/pop/ret round trip
+    {"mixed",
+     {
+         0x31, 0xFE, 0xFF,  // LD SP, 0xFFFE
+         0x3E, 0x91,        // LD A, 0x91
+         0xE0, 0x40,        // LDH (0xFF40), A
+         0x21, 0x00, 0xC0,  // outer: LD HL, 0xC000
+         0x11, 0x00, 0xC8,  // LD DE, 0xC800
+         0x01, 0x00, 0x01,  // LD BC, 0x0100
+         0x2A,              // copy: LDI A, (HL)
+         0x12,              // LD (DE), A
+         0x13,              // INC DE
+         0x0B,              // DEC BC
+         0x78,              // LD A, B
+         0xB1,              // OR C
+         0x20, 0xF8,        // JR NZ, copy
+         0x06, 0x40,        // LD B, 0x40
+         0x78,              // alu: LD A, B
+         0x81,              // ADD A, C
+         0x92,              // SUB D
+         0x8B,              // ADC E
+         0x9C,              // SBC H
+         0xA5,              // AND L
+         0xA8,              // XOR B
+         0xB1,              // OR C
+         0xFE, 0x10,        // CP 0x10
+         0x0C,              // INC C
+         0x15,              // DEC D
+         0xCB, 0x37,        // SWAP A
+         0xCB, 0x7F,        // BIT 7, A
+         0xCB, 0xD9,        // SET 3, C
+         0x05,              // DEC B
+         0x20, 0xEB,        // JR NZ, alu
+         0xCD, 0x85, 0x01,  // CALL sub
+         0xC3, 0x57, 0x01,  // JP outer
+         0xC5,              // sub: PUSH BC
+         0xD5,              // PUSH DE
+         0xD1,              // POP DE
+         0xC1,              // POP BC
+         0xC9,              // RET
+     }},
+    // 8-bit arithmetic only, every op leaves flags for the next one
+    {"alu",
+     {
+         0x06, 0x00,        // outer: LD B, 0x00
+         0x80,              // loop: ADD A, B
+         0x89,              // ADC A, C
+         0x92,              // SUB D
+         0x9B,              // SBC A, E
+         0xBC,              // CP H
+         0xC6, 0x3B,        // ADD A, 0x3B
+         0xCE, 0x11,        // ADC A, 0x11
+         0xD6, 0x07,        // SUB 0x07
+         0xDE, 0x29,        // SBC A, 0x29
+         0xFE, 0x80,        // CP 0x80
+         0x0C,              // INC C
+         0x14,              // INC D
+         0x1D,              // DEC E
+         0x25,              // DEC H
+         0x3C,              // INC A
+         0x05,              // DEC B
+         0x20, 0xE9,        // JR NZ, loop
+         0x18, 0xE5,        // JR outer
+     }},
+    // A little work once a frame, halted the rest of the time
+    {"halt",
+     {
+         0x31, 0xFE, 0xFF,  // LD SP, 0xFFFE
+         0x3E, 0x91,        // LD A, 0x91
+         0xE0, 0x40,        // LDH (0xFF40), A
+         0x3E, 0x01,        // LD A, 0x01
+         0xE0, 0xFF,        // LDH (0xFFFF), A
+         0x76,              // frame: HALT
+         0xAF,              // XOR A
+         0xE0, 0x0F,        // LDH (0xFF0F), A
+         0x06, 0x00,        // LD B, 0x00
+         0x05,              // work: DEC B
+         0x20, 0xFD,        // JR NZ, work
+         0x18, 0xF5,        // JR frame
+     }},
+    // The same, but waiting for a scanline by polling LY
+    {"poll",
+     {
+         0x31, 0xFE, 0xFF,  // LD SP, 0xFFFE
+         0x3E, 0x91,        // LD A, 0x91
+         0xE0, 0x40,        // LDH (0xFF40), A
+         0xF0, 0x44,        // frame: LDH A, (0xFF44)
+         0xFE, 0x90,        // CP 0x90
+         0x20, 0xFA,        // JR NZ, frame
+         0x06, 0x00,        // LD B, 0x00
+         0x05,              // work: DEC B
+         0x20, 0xFD,        // JR NZ, work
+         0xF0, 0x44,        // wait: LDH A, (0xFF44)
+         0xFE, 0x90,        // CP 0x90
+         0x28, 0xFA,        // JR Z, wait
+         0x18, 0xED,        // JR frame
+     }},
+    // Resetting DIV through DE, the second half of a superinstruction, with
+    // the timer counting at 262144 Hz
+    {"timer",
+     {
+         0x31, 0xFE, 0xFF,  // LD SP, 0xFFFE
+         0x3E, 0x05,        // LD A, 0x05
+         0xE0, 0x07,        // LDH (0xFF07), A
+         0x11, 0x04, 0xFF,  // LD DE, 0xFF04
+         0x21, 0x00, 0xC0,  // LD HL, 0xC000
+         0x2A,              // loop: LDI A, (HL)
+         0x12,              // LD (DE), A
+         0x00,              // NOP
+         0x18, 0xFB,        // JR loop
+     }},
+};
+
+// Start the program at 0x150 from a ROM of its own
+static void load(Gameboy &gameboy, const program &p) {
+  std::vector<u8> rom(0x8000, 0);
+  rom[0x101] = 0xC3;  // JP 0x150
+  rom[0x102] = 0x50;
+  rom[0x103] = 0x01;
+  std::copy(p.code.begin(), p.code.end(), rom.begin() + 0x150);
+  gameboy.cpu.mmu.load(std::make_shared<ROM>(std::move(rom)));
+}
+
+// Registers, 0x8000-0xFFFF as the CPU reads it and the time
+static u64 state(Gameboy &gameboy) {
+  CPU &cpu = gameboy.cpu;
+  cpu.syncFlags();
+  u64 hash = 14695981039346656037ULL;
+  auto add = [&](u64 value) { hash = (hash ^ value) * 1099511628211ULL; };
+  for (u16 r : {cpu.reg.af, cpu.reg.bc, cpu.reg.de, cpu.reg.hl, cpu.reg.sp,
+                cpu.reg.pc}) {
+    add(r);
+  }
+  for (u32 addr = 0x8000; addr <= 0xFFFF; addr++) {
+    add(cpu.mmu.read8(addr));
+  }
+  add(gameboy.scheduler.now);
+  return hash;
+}
+
+// Superinstructions have to behave exactly like the two instructions
+static int check(u32 frames) {
+  int failed = 0;
+  for (const program &p : programs) {
+    u64 hashes[2];
+    for (bool fuse : {true, false}) {
+      std::unique_ptr<Gameboy> gameboy(new Gameboy());
+      gameboy->cpu.fuse = fuse;
+      load(*gameboy, p);
+      for (u32 i = 0; i < frames; i++) {
+        gameboy->runUntilVSync();
+      }
+      hashes[fuse] = state(*gameboy);
+    }
+    bool same = hashes[0] == hashes[1];
+    printf("%s: %s\n", p.name, same ? "ok" : "superinstructions differ");
+    failed |= !same;
+  }
+  return failed;
+}
+
+#ifdef GB_PROFILE_PAIRS
+// Disassembly without the operand placeholders
+static std::string mnemonic(const CPU &cpu, u8 op) {
+  std::string s = cpu.instructions[op].disassembly;
+  for (const char *f : {"%02X", "%04X"}) {
+    size_t i = s.find(f);
+    if (i != std::string::npos) {
+      s.replace(i, 4, f[2] == '2' ? "n" : "nn");
+    }
+  }
+  return s;
+}
+
+// Write the pairs that ran most often (at least 0.1% of the time), out of
+// those that can be fused, as a new superinstructions.hpp
+static void writeSuperinstructions(const CPU &cpu, const char *name,
+                                   u64 total) {
+  const u32 maxPairs = 32;
+  std::vector<u32> pairs;
+  for (u32 i = 0; i < 0x10000; i++) {
+    if (cpu.pairCounts[i] * 1000 >= total && CPU::fusable(i >> 8, i & 0xFF)) {
+      pairs.push_back(i);
+    }
+  }
+  std::stable_sort(pairs.begin(), pairs.end(), [&](u32 a, u32 b) {
+    return cpu.pairCounts[a] > cpu.pairCounts[b];
+  });
+  if (pairs.size() > maxPairs) {
+    pairs.resize(maxPairs);
+  }
+
+  FILE *f = fopen("superinstructions.hpp", "w");
+  if (!f) {
+    printf("Can't write superinstructions.hpp\n");
+    return;
+  }
+  fprintf(f,
+          "// gb: a Gameboy Emulator by Don Freiday\n"
+          "// File: superinstructions.hpp\n"
+          "// Description: Instruction pairs with fused handlers\n"
+          "//\n"
+          "// X(op1, op2) for each pair CPU::execute() can run as one "
+          "instruction.\n"
+          "// Generated by gb_profile from %s, %llu instructions; the\n"
+          "// comments give the share of instructions that started each "
+          "pair.\n"
+          "// Build with GB_NO_SUPERINSTRUCTIONS or GB_ACCURATE to leave them "
+          "out.\n\n"
+          "#ifndef GB_SUPERINSTRUCTIONS\n"
+          "#define GB_SUPERINSTRUCTIONS\n\n"
+          "#if defined(GB_NO_SUPERINSTRUCTIONS) || defined(GB_ACCURATE)\n"
+          "#define GB_FUSED_PAIRS(X)\n"
+          "#else\n",
+          name, (unsigned long long)total);
+  std::string line = "#define GB_FUSED_PAIRS(X)";
+  for (u32 pair : pairs) {
+    line.resize(std::max<size_t>(line.size() + 1, 58), ' ');
+    fprintf(f, "%s\\\n", line.c_str());
+    char buf[128];
+    snprintf(buf, sizeof(buf), "  X(0x%02X, 0x%02X) /* %s / %s, %.2f%% */",
+             pair >> 8, pair & 0xFF, mnemonic(cpu, pair >> 8).c_str(),
+             mnemonic(cpu, pair & 0xFF).c_str(),
+             100.0 * cpu.pairCounts[pair] / total);
+    line = buf;
+  }
+  fprintf(f, "%s\n#endif\n\n#endif\n", line.c_str());
+  fclose(f);
+  printf("Wrote %zu pairs to superinstructions.hpp\n", pairs.size());
+}
+#endif
+
+int main(int argc, char **argv) {
+  const char *name = argc > 1 ? argv[1] : "mixed";
+  if (strcmp(name, "check") == 0) {
+    return check(argc > 2 ? strtoul(argv[2], nullptr, 10) : 60);
+  }
+  u64 count = argc > 2 ? strtoull(argv[2], nullptr, 10) : 50000000;
+  bool useJit = false;
+  bool idleSkip = true;
+  bool bulkCopy = true;
+  bool fuse = true;
+  for (int i = 3; i < argc; i++) {
+    useJit |= strcmp(argv[i], "jit") == 0;
+    idleSkip &= strcmp(argv[i], "noidle") != 0;
+    fuse &= strcmp(argv[i], "nofuse") != 0;
+    bulkCopy &= strcmp(argv[i], "nobulk") != 0;
+  }
+
+  static Gameboy gameboy;
+  CPU &cpu = gameboy.cpu;
+  JIT &jit = gameboy.jit;
+  if (useJit && !jit.enabled) {
+    printf("JIT not available on this platform\n");
+    return -1;
+  }
+  jit.enabled = useJit;
+  cpu.idleSkip = idleSkip;
+  cpu.bulkCopy = bulkCopy;
+  cpu.fuse = fuse;
+
+  // Built-in program, or a ROM file
+  const program *builtin = nullptr;
+  for (const program &p : programs) {
+    if (strcmp(p.name, name) == 0) {
+      builtin = &p;
+    }
+  }
+  if (builtin) {
+    load(gameboy, *builtin);
+  } else if (!gameboy.load((char *)name)) {
+    printf("Invalid ROM file: %s\n", name);
+    return -1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  u64 frames = 0;
+  while (gameboy.interpreted + cpu.superinstructions + cpu.bulkInstructions +
+             jit.instructions <
+         count) {
+    frames += gameboy.runUntilVSync();
+    if (cpu.halted && !(cpu.mmu.memory[IE] & 0x1F)) {
+      printf("Halted with no interrupts enabled\n");
+      break;
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  u64 total = gameboy.interpreted + cpu.superinstructions +
+              cpu.bulkInstructions + jit.instructions;
+  printf("%s: %llu instructions, %llu frames in %.3f s: %.2f M instructions/s, "
+         "%.0f frames/s",
+         name, total, frames, elapsed.count(), total / elapsed.count() / 1e6,
+         frames / elapsed.count());
+  if (useJit) {
+    printf(" (%.1f%% compiled)", 100.0 * jit.instructions / total);
+  }
+  if (cpu.idleCycles) {
+    printf(", %.1f%% of cycles skipped in idle loops",
+           100.0 * cpu.idleCycles / gameboy.scheduler.now);
+  }
+  if (cpu.bulkInstructions) {
+    printf(", %.1f%% of instructions in bulk copies and fills",
+           100.0 * cpu.bulkInstructions / total);
+  }
+  printf("\n");
+
+#ifdef GB_PROFILE_PAIRS
+  writeSuperinstructions(cpu, name, total);
+#endif
+  return 0;
+}
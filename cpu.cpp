@@ -2,25 +2,38 @@
 // File: cpu.cpp
 // Description: CPU implementation
 //
-// GB-Z80 interpreter, timers, interrupt handling
+// GB-Z80 interpreter, interrupt handling
 
+#include <algorithm>
+#include <cstring>
+#include "accuracy.hpp"
 #include "cpu.hpp"
+#include "flags.hpp"
 #include "mmu.hpp"
-
-// Set if a carry occurred from the last arithmetic operation or if
-// register A is the smaller value when executing the CP instruction
-#define FLAG_CARRY 4
-
-// Set if a carry occurred from the lower nibble in the last math operation.
-#define FLAG_HALF_CARRY 5
-
-// Set if a subtraction was performed in the last math instruction.
-#define FLAG_SUBTRACT 6  
-
-// Set when the result of an arithmetic operation is zero or two values match when using CP
-#define FLAG_ZERO 7  
-
-CPU::CPU() { reset(); }
+#include "superinstructions.hpp"
+#include "timer.hpp"
+
+// Labels-as-values lets execute() jump straight to an opcode's handler.
+// Emscripten's wasm backend has no indirect branches, so it uses the tables.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(__EMSCRIPTEN__) && \
+    !defined(GB_NO_COMPUTED_GOTO)
+#define GB_COMPUTED_GOTO
+#endif
+
+CPU::CPU() {
+#ifdef GB_PROFILE_PAIRS
+  pairCounts.assign(0x10000, 0);
+  lastOp = 0;
+#endif
+  superinstructions = 0;
+  fuse = true;
+  idleSkip = true;
+  idleCycles = 0;
+  idleBudget = 0;
+  bulkCopy = true;
+  bulkInstructions = 0;
+  reset();
+}
 
 CPU::~CPU() { fout.close(); }
 
@@ -34,19 +47,18 @@ void CPU::reset() {
   reg.h = 0x01;
   reg.l = 0x4D;
   reg.f = 0xB0;
+  lazy.op = FLAGS_SYNCED;
   reg.pc = 0x100;
   reg.sp = 0xFFFE;
   cpu_clock_t = 0;
   ime = false;
   eiDelay = false;
-  dividerCounter = 0;
-  timerCounter = 0;
-  timerMode = 0;       // Clock rate determined by lowest 2 bits of TAC register
-  timerCycles = 1024;  // Initial TAC 00 so GB-Z80 clock speed / inc rate ==
-                       // 4194304÷4096 == 1024 cycles
+  halted = false;
   
   mmu.reset();
   mmu.memory[IF] = 0xE1;
+  mmu.updatePending();
+  flushBlocks(true, true);
 
   debugToFile = false;
   if (debugToFile) {
@@ -55,11 +67,72 @@ void CPU::reset() {
   }
 }
 
+// Record the operands and result of an ALU op. F is computed from them only
+// when something reads it. The carry flag is cheap and INC/DEC need it, so it
+// is computed up front.
+void CPU::deferFlags(u8 op, u8 lhs, u8 rhs, u8 result, bool carry) {
+  lazy.op = op;
+  lazy.lhs = lhs;
+  lazy.rhs = rhs;
+  lazy.result = result;
+  lazy.carry = carry;
+#ifdef GB_EAGER_FLAGS
+  syncFlags();
+#endif
+}
+
+bool CPU::flagZ() {
+  if (lazy.op == FLAGS_SYNCED) {
+    return bitTest(reg.f, FLAG_ZERO);
+  }
+  return lazy.result == 0;
+}
+
+bool CPU::flagC() {
+  if (lazy.op == FLAGS_SYNCED) {
+    return bitTest(reg.f, FLAG_CARRY);
+  }
+  return lazy.carry;
+}
+
+// Drop any pending op and clear F, for ops that set every flag themselves
+void CPU::clearFlags() {
+  lazy.op = FLAGS_SYNCED;
+  reg.f = 0;
+}
+
+// Compute F from the last recorded ALU op
+void CPU::syncFlags() {
+  switch (lazy.op) {
+    case FLAGS_SYNCED:
+      return;
+    case FLAGS_ADD:
+      reg.f = FLAG_TABLES.add[0][lazy.lhs][lazy.rhs];
+      break;
+    case FLAGS_SUB:
+      reg.f = FLAG_TABLES.sub[0][lazy.lhs][lazy.rhs];
+      break;
+    case FLAGS_INC:
+      reg.f = FLAG_TABLES.inc[lazy.result] | (lazy.carry << FLAG_CARRY);
+      break;
+    case FLAGS_DEC:
+      reg.f = FLAG_TABLES.dec[lazy.result] | (lazy.carry << FLAG_CARRY);
+      break;
+    case FLAGS_AND:
+      reg.f = (lazy.result == 0) << FLAG_ZERO | 1 << FLAG_HALF_CARRY;
+      break;
+    default:
+      reg.f = (lazy.result == 0) << FLAG_ZERO;
+      break;
+  }
+  lazy.op = FLAGS_SYNCED;
+}
+
 // Test bit b in register r
 template <typename t>
 void CPU::bit(u8 bit, t reg1) {
-  u8 prevCarry = bitTest(reg.f, FLAG_CARRY);
-  reg.f = 0;
+  u8 prevCarry = flagC();
+  clearFlags();
   if (!bitTest(reg1, bit)) {
     bitSet(reg.f, FLAG_ZERO);
   }
@@ -73,39 +146,18 @@ void CPU::bit(u8 bit, t reg1) {
 template <typename t>
 void CPU::decrementReg(t &reg1) {
   reg1--;
-  bool carry = bitTest(reg.f, FLAG_CARRY);
-  reg.f = 0;
-  bitSet(reg.f, FLAG_SUBTRACT);
-  if (carry) {
-    bitSet(reg.f, FLAG_CARRY);
-  }
-  if (reg1 == 0) {
-    bitSet(reg.f, FLAG_ZERO);
-  }
-  if ((reg1 & 0xF) == 0xF) {
-    bitSet(reg.f, FLAG_HALF_CARRY);
-  }
+  deferFlags(FLAGS_DEC, 0, 0, reg1, flagC());
 }
 
 template <typename t>
 void CPU::incrementReg(t &reg1) {
   reg1++;
-  bool carry = bitTest(reg.f, FLAG_CARRY);
-  reg.f = 0;
-  if (carry) {
-    bitSet(reg.f, FLAG_CARRY);
-  }
-  if (reg1 == 0) {
-    bitSet(reg.f, FLAG_ZERO);
-  }
-  if ((reg1 & 0xF) == 0) {
-    bitSet(reg.f, FLAG_HALF_CARRY);
-  }
+  deferFlags(FLAGS_INC, 0, 0, reg1, flagC());
 }
 
 template <typename t>
 void CPU::rotateRightCarry(t &reg1) {
-  reg.f = 0;
+  clearFlags();
   // Low bit of register is shifted into carry flag
   if (bitTest(reg1, 1)) {
     bitSet(reg.f, FLAG_CARRY);
@@ -121,8 +173,8 @@ void CPU::rotateRightCarry(t &reg1) {
 
 template <typename t>
 void CPU::rotateRight(t &reg1) {
-  bool prevCarry = bitTest(reg.f, FLAG_CARRY);
-  reg.f = 0;
+  bool prevCarry = flagC();
+  clearFlags();
   bool carry = bitTest(reg1, 0);
   reg1 >>= 1;
   reg1 += (prevCarry << 7);
@@ -136,7 +188,7 @@ void CPU::rotateRight(t &reg1) {
 
 template <typename t>
 void CPU::rotateLeftCarry(t &reg1) {
-  reg.f = 0;
+  clearFlags();
   // High bit is shifted into carry flag
   if (bitTest(reg1, 7)) {
     bitSet(reg.f, FLAG_CARRY);
@@ -152,8 +204,8 @@ void CPU::rotateLeftCarry(t &reg1) {
 
 template <typename t>
 void CPU::rotateLeft(t &reg1) {
-  bool prevCarry = bitTest(reg.f, FLAG_CARRY);
-  reg.f = 0;
+  bool prevCarry = flagC();
+  clearFlags();
   bool carry = bitTest(reg1, 7);
   reg1 <<= 1;
   reg1 += prevCarry;
@@ -168,7 +220,7 @@ void CPU::rotateLeft(t &reg1) {
 // Shift n left into Carry. LSB of n set to 0.
 template <typename t>
 void CPU::sla(t &reg1) {
-  reg.f = 0;
+  clearFlags();
   if (bitTest(reg1, 7)) {
     bitSet(reg.f, FLAG_CARRY);
   }
@@ -181,7 +233,7 @@ void CPU::sla(t &reg1) {
 // Shift n right into Carry. MSB doesn't change.
 template <typename t>
 void CPU::sra(t &reg1) {
-  reg.f = 0;
+  clearFlags();
   u8 msb = bitTest(reg1, 7);
   if (bitTest(reg1, 0)) {
     bitSet(reg.f, FLAG_CARRY);
@@ -196,7 +248,7 @@ void CPU::sra(t &reg1) {
 // Shift n right into Carry. MSB set to 0.
 template <typename t>
 void CPU::srl(t &reg1) {
-  reg.f = 0;
+  clearFlags();
   if (bitTest(reg1, 0)) {
     bitSet(reg.f, FLAG_CARRY);
   }
@@ -208,59 +260,33 @@ void CPU::srl(t &reg1) {
 
 template <typename t>
 void CPU::subtract(t n) {
-  reg.f = 0;
-  if (reg.a < n) {
-    bitSet(reg.f, FLAG_CARRY);
-  }
-  if ((reg.a & 0xF) < (n & 0xF)) {
-    bitSet(reg.f, FLAG_HALF_CARRY);
-  }
-  bitSet(reg.f, FLAG_SUBTRACT);
+  u8 a = reg.a;
   reg.a -= n;
-  if (reg.a == 0) {
-    bitSet(reg.f, FLAG_ZERO);
-  }
+  deferFlags(FLAGS_SUB, a, n, reg.a, a < n);
 }
 
 // Subtract n + Carry flag from A.
 // todo: verify this
 template <typename t>
 void CPU::subtractCarry(t n) {
+  syncFlags();
   u8 prevCarry = bitTest(reg.f, FLAG_CARRY);
-  if (reg.a < n + prevCarry) {
-    bitSet(reg.f, FLAG_CARRY);
-  }
-  if ((reg.a & 0x0F) < ((n + prevCarry) & 0x0F)) {
-    bitSet(reg.f, FLAG_HALF_CARRY);
-  }
-  bitSet(reg.f, FLAG_SUBTRACT);
+  reg.f |= FLAG_TABLES.sub[prevCarry][reg.a][(u8)n];
   reg.a -= (n + prevCarry);
-  if (reg.a == 0) {
-    bitSet(reg.f, FLAG_ZERO);
-  }
 }
 
 // Add n to A.
 template <typename t>
 void CPU::add(t n) {
-  reg.f = 0;
-  if ((reg.a + n) > 0xFF) {
-    bitSet(reg.f, FLAG_CARRY);
-  }
-  if ((reg.a & 0xF) + (n & 0xF) > 0xF) {
-    bitSet(reg.f, FLAG_HALF_CARRY);
-  }
-  bitClear(reg.f, FLAG_SUBTRACT);
+  u8 a = reg.a;
   reg.a += n;
-  if (reg.a == 0) {
-    bitSet(reg.f, FLAG_ZERO);
-  }
+  deferFlags(FLAGS_ADD, a, n, reg.a, reg.a < a);
 }
 
 // Add n to reg1.
 template <typename t>
 void CPU::add(t &reg1, t n) {
-  reg.f = 0;
+  clearFlags();
   if ((reg1 + n) > 0xFF) {
     bitSet(reg.f, FLAG_CARRY);
   }
@@ -277,8 +303,8 @@ void CPU::add(t &reg1, t n) {
 // Add n to reg1.
 template <typename t>
 void CPU::add16(t &reg1, t n) {
-  bool zero = bitTest(reg.f, FLAG_ZERO);
-  reg.f = 0;
+  bool zero = flagZ();
+  clearFlags();
   if ((reg1 + n) > 0xFFFF) {
     bitSet(reg.f, FLAG_CARRY);
   }
@@ -296,60 +322,31 @@ void CPU::add16(t &reg1, t n) {
 // todo: is this correct? verify
 template <typename t>
 void CPU::addCarry(t n) {
-  u8 prevCarry = bitTest(reg.f, FLAG_CARRY);
-  reg.f = 0;
-
-  if (reg.a + n + prevCarry > 0xFF) {
-    bitSet(reg.f, FLAG_CARRY);
-  }
-
-  if ((reg.a & 0x0F) + (n & 0x0F) + prevCarry > 0x0F) {
-    bitSet(reg.f, FLAG_HALF_CARRY);
-  }
-
+  u8 prevCarry = flagC();
+  clearFlags();
+  reg.f = FLAG_TABLES.add[prevCarry][reg.a][(u8)n];
   reg.a += n + prevCarry;
-
-  if (reg.a == 0) {
-    bitSet(reg.f, FLAG_ZERO);
-  }
 }
 
 // Compare A with n. This is basically an A - n subtraction instruction but the
 // results are thrown away.
 template <typename t>
 void CPU::compare(t num) {
-  reg.f = 0;
-  if (reg.a < num) {
-    bitSet(reg.f, FLAG_CARRY);
-  }
-  if ((reg.a & 0xF) < (num & 0xF)) {
-    bitSet(reg.f, FLAG_HALF_CARRY);
-  }
-  bitSet(reg.f, FLAG_SUBTRACT);
-  if (reg.a - num == 0) {
-    bitSet(reg.f, FLAG_ZERO);
-  }
+  deferFlags(FLAGS_SUB, reg.a, num, reg.a - num, reg.a < num);
 }
 
 // Logical OR n with register A, result in A.
 template <typename t>
 void CPU::orReg(t reg1) {
   reg.a |= reg1;
-  reg.f = 0;
-  if (reg.a == 0) {
-    bitSet(reg.f, FLAG_ZERO);
-  }
+  deferFlags(FLAGS_OR, 0, 0, reg.a, false);
 }
 
 // Logically AND n with A, result in A.
 template <typename t>
 void CPU::andReg(t reg1) {
   reg.a &= reg1;
-  reg.f = 0;
-  if (reg.a == 0) {
-    bitSet(reg.f, FLAG_ZERO);
-  }
-  bitSet(reg.f, FLAG_HALF_CARRY);
+  deferFlags(FLAGS_AND, 0, 0, reg.a, false);
 }
 
 // Swap upper & lower nibles of n.
@@ -358,7 +355,7 @@ void CPU::swapReg(t &reg1) {
   t lowerNibble = reg1 >> 4;
   reg1 <<= 4;
   reg1 |= lowerNibble;
-  reg.f = 0;
+  clearFlags();
   if (reg1 == 0) {
     bitSet(reg.f, FLAG_ZERO);
   }
@@ -368,2818 +365,1737 @@ void CPU::swapReg(t &reg1) {
 template <typename t>
 void CPU::xorReg(t reg1) {
   reg.a ^= reg1;
-  reg.f = 0;
-  if (reg.a == 0) {
-    bitSet(reg.f, FLAG_ZERO);
+  deferFlags(FLAGS_OR, 0, 0, reg.a, false);
+}
+
+// Register operand encoded in an opcode's bit fields: bits 0-2 for the source
+// and bits 3-5 for the destination.
+// 0 = B, 1 = C, 2 = D, 3 = E, 4 = H, 5 = L, 6 = (HL), 7 = A
+template <u8 r>
+u8 &CPU::regR() {
+  static_assert(r != 6 && r < 8, "(HL) is not a register");
+  if constexpr (r == 0) {
+    return reg.b;
+  } else if constexpr (r == 1) {
+    return reg.c;
+  } else if constexpr (r == 2) {
+    return reg.d;
+  } else if constexpr (r == 3) {
+    return reg.e;
+  } else if constexpr (r == 4) {
+    return reg.h;
+  } else if constexpr (r == 5) {
+    return reg.l;
+  } else {
+    return reg.a;
   }
 }
 
-bool CPU::execute() {
-  if (debugToFile) {
-    fout << std::setfill('0') << std::setw(4) << std::hex << reg.pc + 1 << ": "
-         << std::setfill('0') << std::setw(4) << " af=" << reg.af
-         << std::setfill('0') << std::setw(4) << " bc=" << reg.bc
-         << std::setfill('0') << std::setw(4) << " de=" << reg.de
-         << std::setfill('0') << std::setw(4) << " hl=" << reg.hl
-         << std::setfill('0') << std::setw(4) << " sp=" << reg.sp << std::endl;
+template <u8 r>
+u8 CPU::readR() {
+  if constexpr (r == 6) {
+    return mmu.read8(reg.hl);
+  } else {
+    return regR<r>();
   }
-  // Fetch the opcode from MMU and increment PC
-  u8 op = mmu.read8(reg.pc++);
-  // Parse operand and print disassembly of instruction
-  u16 operand;
-  if (instructions[op].operandLength == 1) {
-    operand = mmu.read8(reg.pc);
-  } else if (instructions[op].operandLength == 2) {
-    operand = mmu.read16(reg.pc);
+}
+
+template <u8 r>
+void CPU::writeR(u8 value) {
+  if constexpr (r == 6) {
+    mmu.write8(reg.hl, value);
+  } else {
+    regR<r>() = value;
   }
+}
 
-  // Adjust PC
-  reg.pc += instructions[op].operandLength;
+// Apply f to operand r in place. (HL) is read, modified and written back.
+template <u8 r, typename F>
+void CPU::modifyR(F f) {
+  if constexpr (r == 6) {
+    u8 val = mmu.read8(reg.hl);
+    f(val);
+    mmu.write8(reg.hl, val);
+  } else {
+    f(regR<r>());
+  }
+}
 
-  // Update cpu clock
-  cpu_clock_t = instructions[op].cycles;
+// ALU operation encoded in bits 3-5 of opcodes 0x80-0xBF:
+// ADD, ADC, SUB, SBC, AND, XOR, OR, CP
+template <u8 n>
+void CPU::alu(u8 value) {
+  if constexpr (n == 0) {
+    add(value);
+  } else if constexpr (n == 1) {
+    addCarry(value);
+  } else if constexpr (n == 2) {
+    subtract(value);
+  } else if constexpr (n == 3) {
+    subtractCarry(value);
+  } else if constexpr (n == 4) {
+    andReg(value);
+  } else if constexpr (n == 5) {
+    xorReg(value);
+  } else if constexpr (n == 6) {
+    orReg(value);
+  } else {
+    compare(value);
+  }
+}
 
-  // Go go go!
-  switch (op) {
-    // NOP
-    case 0x00:
-      break;
+// Rotate or shift encoded in bits 3-5 of CB opcodes 0x00-0x3F:
+// RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL
+template <u8 n>
+void CPU::rotateShift(u8 &value) {
+  if constexpr (n == 0) {
+    rotateLeftCarry(value);
+  } else if constexpr (n == 1) {
+    rotateRightCarry(value);
+  } else if constexpr (n == 2) {
+    rotateLeft(value);
+  } else if constexpr (n == 3) {
+    rotateRight(value);
+  } else if constexpr (n == 4) {
+    sla(value);
+  } else if constexpr (n == 5) {
+    sra(value);
+  } else if constexpr (n == 6) {
+    swapReg(value);
+  } else {
+    srl(value);
+  }
+}
 
-    // LD BC, nnnn
-    case 0x01:
-      reg.bc = operand;
-      break;
+// Base instruction set. Each opcode is a specialization of CPU::opcode; the
+// dispatch tables below are built from them.
+//
+// The register blocks are generated from the opcode's bit fields:
+// 0x40-0x7F: LD r, r' (0x76 is HALT, specialized below)
+// 0x80-0xBF: ALU A, r
+template <u8 op>
+bool CPU::opcode(u16 operand) {
+  static_assert(op >= 0x40 && op <= 0xBF && op != 0x76,
+                "opcode has no generated handler");
+  if constexpr (op < 0x80) {
+    writeR<(op >> 3) & 7>(readR<op & 7>());
+  } else {
+    alu<(op >> 3) & 7>(readR<op & 7>());
+  }
+  return true;
+}
 
-    // LD (BC), A
-    case 0x02:
-      mmu.write8(reg.bc, reg.a);
-      break;
+// Extended instruction set via 0xCB prefix, generated from the opcode's bit
+// fields. The low three bits select the register.
+// 0x00-0x3F: rotates and shifts
+// 0x40-0x7F: BIT b, r
+// 0x80-0xBF: RES b, r
+// 0xC0-0xFF: SET b, r
+template <u8 op>
+bool CPU::opcodeCB() {
+  const u8 b = (op >> 3) & 7;
+  if constexpr (op < 0x40) {
+    modifyR<op & 7>([this](u8 &val) { rotateShift<b>(val); });
+  } else if constexpr (op < 0x80) {
+    bit(b, readR<op & 7>());
+  } else if constexpr (op < 0xC0) {
+    modifyR<op & 7>([](u8 &val) { bitClear(val, b); });
+  } else {
+    modifyR<op & 7>([](u8 &val) { bitSet(val, b); });
+  }
+  return true;
+}
 
-    // INC BC
-    // Flags are not affected by 16bit increment
-    case 0x03:
-      reg.bc++;
-      break;
 
-    // INC B
-    case 0x04:
-      incrementReg(reg.b);
-      break;
+// NOP
+template <>
+bool CPU::opcode<0x00>(u16 operand) {
+  return true;
+}
 
-    // DEC B
-    case 0x05:
-      decrementReg(reg.b);
-      break;
+// LD BC, nnnn
+template <>
+bool CPU::opcode<0x01>(u16 operand) {
+  reg.bc = operand;
+  return true;
+}
 
-    // LD B, nn
-    case 0x06:
-      reg.b = operand;
-      break;
+// LD (BC), A
+template <>
+bool CPU::opcode<0x02>(u16 operand) {
+  mmu.write8(reg.bc, reg.a);
+  return true;
+}
 
-    // RLCA
-    case 0x07:
-      rotateLeftCarry(operand);
-      break;
+// INC BC
+// Flags are not affected by 16bit increment
+template <>
+bool CPU::opcode<0x03>(u16 operand) {
+  reg.bc++;
+  return true;
+}
 
-    // LD nnnn, SP
-    case 0x08:
-      mmu.write16(operand, reg.sp);
-      break;
+// INC B
+template <>
+bool CPU::opcode<0x04>(u16 operand) {
+  incrementReg(reg.b);
+  return true;
+}
 
-    // ADD HL, BC
-    case 0x09:
-      add16(reg.hl, reg.bc);
-      break;
+// DEC B
+template <>
+bool CPU::opcode<0x05>(u16 operand) {
+  decrementReg(reg.b);
+  return true;
+}
 
-    // LD A, (BC)
-    case 0x0A:
-      reg.a = mmu.read8(reg.bc);
-      break;
+// LD B, nn
+template <>
+bool CPU::opcode<0x06>(u16 operand) {
+  reg.b = operand;
+  return true;
+}
 
-    // DEC BC
-    // Flags are not affected by 16bit decrement
-    case 0x0B:
-      reg.bc--;
-      break;
+// RLCA
+template <>
+bool CPU::opcode<0x07>(u16 operand) {
+  rotateLeftCarry(operand);
+  return true;
+}
 
-    // INC C
-    case 0x0C:
-      incrementReg(reg.c);
-      break;
+// LD nnnn, SP
+template <>
+bool CPU::opcode<0x08>(u16 operand) {
+  mmu.write16(operand, reg.sp);
+  return true;
+}
 
-    // DEC C
-    case 0x0D:
-      decrementReg(reg.c);
-      break;
+// ADD HL, BC
+template <>
+bool CPU::opcode<0x09>(u16 operand) {
+  add16(reg.hl, reg.bc);
+  return true;
+}
 
-    // LD C, nn
-    case 0x0E:
-      reg.c = operand;
-      break;
+// LD A, (BC)
+template <>
+bool CPU::opcode<0x0A>(u16 operand) {
+  reg.a = mmu.read8(reg.bc);
+  return true;
+}
 
-    // RRC A
-    // Performs a RRC A faster and modifies the flags differently.
-    case 0x0F:
-      rotateRightCarry(reg.a);
-      bitClear(reg.f, FLAG_ZERO);
-      break;
+// DEC BC
+// Flags are not affected by 16bit decrement
+template <>
+bool CPU::opcode<0x0B>(u16 operand) {
+  reg.bc--;
+  return true;
+}
 
-    // STOP
-    case 0x10:
-      // todo: GBC speed modes
-      break;
+// INC C
+template <>
+bool CPU::opcode<0x0C>(u16 operand) {
+  incrementReg(reg.c);
+  return true;
+}
 
-    // LD DE, nnnn
-    case 0x11:
-      reg.de = operand;
-      break;
+// DEC C
+template <>
+bool CPU::opcode<0x0D>(u16 operand) {
+  decrementReg(reg.c);
+  return true;
+}
 
-    // LD (DE), A
-    case 0x12:
-      mmu.write8(reg.de, reg.a);
-      break;
+// LD C, nn
+template <>
+bool CPU::opcode<0x0E>(u16 operand) {
+  reg.c = operand;
+  return true;
+}
 
-    // INC DE
-    // Flags are not affected by 16bit increment
-    case 0x13:
-      reg.de++;
-      break;
+// RRC A
+// Performs a RRC A faster and modifies the flags differently.
+template <>
+bool CPU::opcode<0x0F>(u16 operand) {
+  rotateRightCarry(reg.a);
+  bitClear(reg.f, FLAG_ZERO);
+  return true;
+}
 
-    // INC D
-    case 0x14:
-      incrementReg(reg.d);
-      break;
+// STOP
+template <>
+bool CPU::opcode<0x10>(u16 operand) {
+  // todo: GBC speed modes
+  return true;
+}
 
-    // DEC D
-    case 0x15:
-      decrementReg(reg.d);
-      break;
+// LD DE, nnnn
+template <>
+bool CPU::opcode<0x11>(u16 operand) {
+  reg.de = operand;
+  return true;
+}
 
-    // LD D, nn
-    case 0x16:
-      reg.d = operand;
-      break;
+// LD (DE), A
+template <>
+bool CPU::opcode<0x12>(u16 operand) {
+  mmu.write8(reg.de, reg.a);
+  return true;
+}
 
-    // RL A
-    case 0x17:
-      rotateLeft(reg.a);
-      break;
+// INC DE
+// Flags are not affected by 16bit increment
+template <>
+bool CPU::opcode<0x13>(u16 operand) {
+  reg.de++;
+  return true;
+}
 
-    // JR nn
-    case 0x18:
-      reg.pc += (s8)operand;
-      break;
+// INC D
+template <>
+bool CPU::opcode<0x14>(u16 operand) {
+  incrementReg(reg.d);
+  return true;
+}
 
-    // ADD HL, DE
-    case 0x19:
-      add16(reg.hl, reg.de);
-      break;
+// DEC D
+template <>
+bool CPU::opcode<0x15>(u16 operand) {
+  decrementReg(reg.d);
+  return true;
+}
 
-    // LD A, (DE)
-    case 0x1A:
-      reg.a = mmu.read8(reg.de);
-      break;
+// LD D, nn
+template <>
+bool CPU::opcode<0x16>(u16 operand) {
+  reg.d = operand;
+  return true;
+}
 
-    // DEC DE
-    // Flags are not affected by 16bit decrement
-    case 0x1B:
-      reg.de--;
-      break;
+// RL A
+template <>
+bool CPU::opcode<0x17>(u16 operand) {
+  rotateLeft(reg.a);
+  return true;
+}
 
-    // INC E
-    case 0x1C:
-      incrementReg(reg.e);
-      break;
+// JR nn
+template <>
+bool CPU::opcode<0x18>(u16 operand) {
+  reg.pc += (s8)operand;
+  return true;
+}
 
-    // DEC E
-    case 0x1D:
-      decrementReg(reg.e);
-      break;
+// ADD HL, DE
+template <>
+bool CPU::opcode<0x19>(u16 operand) {
+  add16(reg.hl, reg.de);
+  return true;
+}
 
-    // LD E, nn
-    case 0x1E:
-      reg.e = operand;
-      break;
+// LD A, (DE)
+template <>
+bool CPU::opcode<0x1A>(u16 operand) {
+  reg.a = mmu.read8(reg.de);
+  return true;
+}
 
-    // RRA
-    case 0x1F:
-      rotateRight(reg.a);
-      break;
+// DEC DE
+// Flags are not affected by 16bit decrement
+template <>
+bool CPU::opcode<0x1B>(u16 operand) {
+  reg.de--;
+  return true;
+}
 
-    // JR nz nn
-    case 0x20:
-      if (!bitTest(reg.f, FLAG_ZERO)) {
-        reg.pc += (s8)(operand);
-        cpu_clock_t += 4;
-      }
-      break;
+// INC E
+template <>
+bool CPU::opcode<0x1C>(u16 operand) {
+  incrementReg(reg.e);
+  return true;
+}
 
-    // LD hl, nnnn
-    case 0x21:
-      reg.hl = operand;
-      break;
+// DEC E
+template <>
+bool CPU::opcode<0x1D>(u16 operand) {
+  decrementReg(reg.e);
+  return true;
+}
 
-    // LDI (HL), A
-    case 0x22:
-      mmu.write8(reg.hl++, reg.a);
-      break;
+// LD E, nn
+template <>
+bool CPU::opcode<0x1E>(u16 operand) {
+  reg.e = operand;
+  return true;
+}
 
-    // INC HL
-    // Flags are not affected by 16bit increment
-    case 0x23:
-      reg.hl++;
-      break;
+// RRA
+template <>
+bool CPU::opcode<0x1F>(u16 operand) {
+  rotateRight(reg.a);
+  return true;
+}
 
-    // INC H
-    case 0x24:
-      incrementReg(reg.h);
-      break;
+// JR nz nn
+template <>
+bool CPU::opcode<0x20>(u16 operand) {
+  if (!flagZ()) {
+    reg.pc += (s8)(operand);
+    cpu_clock_t += 4;
+  }
+  return true;
+}
 
-    // DEC H
-    case 0x25:
-      decrementReg(reg.h);
-      break;
-
-    // LD H, 0x%02X
-    case 0x26:
-      reg.h = operand;
-      break;
-
-    // DAA
-    // This instruction adjusts register A so that the correct representation of
-    // Binary Coded Decimal (BCD) is obtained.
-    // Adapted from http://forums.nesdev.com/viewtopic.php?f=20&t=15944
-    case 0x27: {
-      bitClear(reg.f, FLAG_ZERO);
-      if (!bitTest(reg.f, FLAG_SUBTRACT)) {
-        if (bitTest(reg.f, FLAG_CARRY) || reg.a > 0x99) {
-          reg.a += 0x60;
-          bitSet(reg.f, FLAG_CARRY);
-        }
-        if (bitTest(reg.f, FLAG_HALF_CARRY) || (reg.a & 0x0F) > 0x09) {
-          reg.a += 0x6;
-        }
-      } else {
-        if (bitTest(reg.f, FLAG_CARRY)) {
-          reg.a -= 0x60;
-        }
-        if (bitTest(reg.f, FLAG_HALF_CARRY)) {
-          reg.a -= 0x06;
-        }
-      }
-      if (reg.a == 0) {
-        bitSet(reg.f, FLAG_ZERO);
-      }
-      bitClear(reg.f, FLAG_HALF_CARRY);
-    }
-
-    break;
-
-    // JR Z, nn
-    case 0x28:
-      if (bitTest(reg.f, FLAG_ZERO)) {
-        reg.pc += (s8)operand;
-        cpu_clock_t += 4;
-      }
-      break;
-
-    // ADD HL, HL
-    case 0x29:
-      add16(reg.hl, reg.hl);
-      break;
-
-    // LDI A, (HL)
-    case 0x2A:
-      reg.a = mmu.read8(reg.hl++);
-      break;
-
-    // DEC HL
-    // Flags are not affected by 16bit decrement
-    case 0x2B:
-      reg.hl--;
-      break;
-
-    // INC L
-    case 0x2C:
-      incrementReg(reg.l);
-      break;
-
-    // DEC L
-    case 0x2D:
-      decrementReg(reg.l);
-      break;
-
-    // LD L, nn
-    case 0x2E:
-      reg.l = operand;
-      break;
-
-    // CPL
-    // Complement A register. (Flip all bits.)
-    case 0x2F:
-      reg.a = ~reg.a;
-      bitSet(reg.f, FLAG_SUBTRACT);
-      bitSet(reg.f, FLAG_HALF_CARRY);
-      break;
+// LD hl, nnnn
+template <>
+bool CPU::opcode<0x21>(u16 operand) {
+  reg.hl = operand;
+  return true;
+}
 
-    // JR NC, 0x%02X
-    case 0x30:
-      if (!bitTest(reg.f, FLAG_CARRY)) {
-        cpu_clock_t += 4;
-        reg.pc += (s8)operand;
-      }
-      break;
+// LDI (HL), A
+template <>
+bool CPU::opcode<0x22>(u16 operand) {
+  mmu.write8(reg.hl++, reg.a);
+  return true;
+}
 
-    // LD SP, nnnn
-    case 0x31:
-      reg.sp = operand;
-      break;
+// INC HL
+// Flags are not affected by 16bit increment
+template <>
+bool CPU::opcode<0x23>(u16 operand) {
+  reg.hl++;
+  return true;
+}
 
-    // LDD (hl--), a
-    case 0x32:
-      mmu.write8(reg.hl--, reg.a);
-      break;
+// INC H
+template <>
+bool CPU::opcode<0x24>(u16 operand) {
+  incrementReg(reg.h);
+  return true;
+}
 
-    // INC SP
-    // Flags are not affected by 16bit increment
-    case 0x33:
-      reg.sp++;
-      break;
+// DEC H
+template <>
+bool CPU::opcode<0x25>(u16 operand) {
+  decrementReg(reg.h);
+  return true;
+}
 
-    // INC (HL)
-    case 0x34: {
-      u8 byte = mmu.read8(reg.hl);
-      incrementReg(byte);
-      mmu.write8(reg.hl, byte);
-    } break;
-
-    // DEC (HL)
-    case 0x35: {
-      u8 val = mmu.read8(reg.hl);
-      decrementReg(val);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // LD (HL), nn
-    case 0x36:
-      mmu.write8(reg.hl, operand);
-      break;
+// LD H, 0x%02X
+template <>
+bool CPU::opcode<0x26>(u16 operand) {
+  reg.h = operand;
+  return true;
+}
 
-    // SCF
-    case 0x37:
-      bitClear(reg.f, FLAG_SUBTRACT);
-      bitClear(reg.f, FLAG_HALF_CARRY);
+// DAA
+// This instruction adjusts register A so that the correct representation of
+// Binary Coded Decimal (BCD) is obtained.
+// Adapted from http://forums.nesdev.com/viewtopic.php?f=20&t=15944
+template <>
+bool CPU::opcode<0x27>(u16 operand) {
+  syncFlags();
+  bitClear(reg.f, FLAG_ZERO);
+  if (!bitTest(reg.f, FLAG_SUBTRACT)) {
+    if (bitTest(reg.f, FLAG_CARRY) || reg.a > 0x99) {
+      reg.a += 0x60;
       bitSet(reg.f, FLAG_CARRY);
-      break;
-
-    // JR C, 0x%02X
-    case 0x38:
-      if (bitTest(reg.f, FLAG_CARRY)) {
-        cpu_clock_t += 4;
-        reg.pc += (s8)operand;
-      }
-      break;
-
-    // ADD HL, SP
-    case 0x39:
-      add16(reg.hl, reg.sp);
-      break;
-
-    // LDD A, (HL)
-    case 0x3A:
-      reg.a = mmu.read8(reg.hl--);
-      break;
-
-    // DEC SP
-    // Flags are not affected by 16bit decrement
-    case 0x3B:
-      reg.sp--;
-      break;
-
-    // INC A
-    case 0x3C:
-      incrementReg(reg.a);
-      break;
-
-    // DEC A
-    case 0x3D:
-      decrementReg(reg.a);
-      break;
-
-    // LD A, nn
-    case 0x3E:
-      reg.a = operand;
-      break;
-
-    // CCF
-    // Complement carry flag
-    case 0x3F:
-      bitClear(reg.f, FLAG_SUBTRACT);
-      bitClear(reg.f, FLAG_HALF_CARRY);
-      if (bitTest(reg.f, FLAG_CARRY)) {
-        bitClear(reg.f, FLAG_CARRY);
-      } else {
-        bitSet(reg.f, FLAG_CARRY);
-      }
-      break;
-
-    // LD B, B
-    case 0x40:
-      // reg.b = reg.b;
-      break;
-
-    // LD B, C
-    case 0x41:
-      reg.b = reg.c;
-      break;
-
-    // LD B, D
-    case 0x42:
-      reg.b = reg.d;
-      break;
-
-    // LD B, E
-    case 0x43:
-      reg.b = reg.e;
-      break;
-
-    // LD B, H
-    case 0x44:
-      reg.b = reg.h;
-      break;
-
-    // LD B, L
-    case 0x45:
-      reg.b = reg.l;
-      break;
-
-    // LD B, (HL)
-    case 0x46:
-      reg.b = mmu.read8(reg.hl);
-      break;
-
-    // LD B, A
-    case 0x47:
-      reg.b = reg.a;
-      break;
-
-      // LD C, B
-    case 0x48:
-      reg.c = reg.b;
-      break;
-
-    // LD C, C
-    case 0x49:
-      // reg.c = reg.c
-      break;
-
-    // LD C, D
-    case 0x4A:
-      reg.c = reg.d;
-      break;
-
-    // LD C, E
-    case 0x4B:
-      reg.c = reg.e;
-      break;
-
-    // LD C, H
-    case 0x4C:
-      reg.c = reg.h;
-      break;
-
-    // LD C, L
-    case 0x4D:
-      reg.c = reg.l;
-      break;
-
-    // LD C, (HL)
-    case 0x4E:
-      reg.c = mmu.read8(reg.hl);
-      break;
-
-    // LD C, A
-    case 0x4F:
-      reg.c = reg.a;
-      break;
-
-    // LD D, B
-    case 0x50:
-      reg.d = reg.b;
-      break;
-
-    // LD D, C
-    case 0x51:
-      reg.d = reg.c;
-      break;
-
-    // LD D, D
-    case 0x52:
-      // reg.d = reg.d;
-      break;
-
-    // LD D, E
-    case 0x53:
-      reg.d = reg.e;
-      break;
-
-    // LD D, H
-    case 0x54:
-      reg.d = reg.h;
-      break;
+    }
+    if (bitTest(reg.f, FLAG_HALF_CARRY) || (reg.a & 0x0F) > 0x09) {
+      reg.a += 0x6;
+    }
+  } else {
+    if (bitTest(reg.f, FLAG_CARRY)) {
+      reg.a -= 0x60;
+    }
+    if (bitTest(reg.f, FLAG_HALF_CARRY)) {
+      reg.a -= 0x06;
+    }
+  }
+  if (reg.a == 0) {
+    bitSet(reg.f, FLAG_ZERO);
+  }
+  bitClear(reg.f, FLAG_HALF_CARRY);
+  return true;
+}
 
-    // LD D, L
-    case 0x55:
-      reg.d = reg.l;
-      break;
+// JR Z, nn
+template <>
+bool CPU::opcode<0x28>(u16 operand) {
+  if (flagZ()) {
+    reg.pc += (s8)operand;
+    cpu_clock_t += 4;
+  }
+  return true;
+}
 
-    // LD D, (HL)
-    case 0x56:
-      reg.d = mmu.read8(reg.hl);
-      break;
+// ADD HL, HL
+template <>
+bool CPU::opcode<0x29>(u16 operand) {
+  add16(reg.hl, reg.hl);
+  return true;
+}
 
-    // LD D, A
-    case 0x57:
-      reg.d = reg.a;
-      break;
+// LDI A, (HL)
+template <>
+bool CPU::opcode<0x2A>(u16 operand) {
+  reg.a = mmu.read8(reg.hl++);
+  return true;
+}
 
-    // LD E, B
-    case 0x58:
-      reg.e = reg.b;
-      break;
+// DEC HL
+// Flags are not affected by 16bit decrement
+template <>
+bool CPU::opcode<0x2B>(u16 operand) {
+  reg.hl--;
+  return true;
+}
 
-    // LD E, C
-    case 0x59:
-      reg.e = reg.c;
-      break;
+// INC L
+template <>
+bool CPU::opcode<0x2C>(u16 operand) {
+  incrementReg(reg.l);
+  return true;
+}
 
-    // LD E, D
-    case 0x5A:
-      reg.e = reg.d;
-      break;
+// DEC L
+template <>
+bool CPU::opcode<0x2D>(u16 operand) {
+  decrementReg(reg.l);
+  return true;
+}
 
-    // LD E, E
-    case 0x5B:
-      // reg.e = reg.e;
-      break;
+// LD L, nn
+template <>
+bool CPU::opcode<0x2E>(u16 operand) {
+  reg.l = operand;
+  return true;
+}
 
-    // LD E, H
-    case 0x5C:
-      reg.e = reg.h;
-      break;
+// CPL
+// Complement A register. (Flip all bits.)
+template <>
+bool CPU::opcode<0x2F>(u16 operand) {
+  syncFlags();
+  reg.a = ~reg.a;
+  bitSet(reg.f, FLAG_SUBTRACT);
+  bitSet(reg.f, FLAG_HALF_CARRY);
+  return true;
+}
 
-    // LD E, L
-    case 0x5D:
-      reg.e = reg.l;
-      break;
+// JR NC, 0x%02X
+template <>
+bool CPU::opcode<0x30>(u16 operand) {
+  if (!flagC()) {
+    cpu_clock_t += 4;
+    reg.pc += (s8)operand;
+  }
+  return true;
+}
 
-    // LD E, (HL)
-    case 0x5E:
-      reg.e = mmu.read8(reg.hl);
-      break;
+// LD SP, nnnn
+template <>
+bool CPU::opcode<0x31>(u16 operand) {
+  reg.sp = operand;
+  return true;
+}
 
-    // LD E, A
-    case 0x5F:
-      reg.e = reg.a;
-      break;
+// LDD (hl--), a
+template <>
+bool CPU::opcode<0x32>(u16 operand) {
+  mmu.write8(reg.hl--, reg.a);
+  return true;
+}
 
-    // LD H, B
-    case 0x60:
-      reg.h = reg.b;
-      break;
+// INC SP
+// Flags are not affected by 16bit increment
+template <>
+bool CPU::opcode<0x33>(u16 operand) {
+  reg.sp++;
+  return true;
+}
 
-    // LD H, C
-    case 0x61:
-      reg.h = reg.c;
-      break;
+// INC (HL)
+template <>
+bool CPU::opcode<0x34>(u16 operand) {
+  u8 byte = mmu.read8(reg.hl);
+  incrementReg(byte);
+  mmu.write8(reg.hl, byte);
+  return true;
+}
 
-    // LD H, D
-    case 0x62:
-      reg.h = reg.d;
-      break;
+// DEC (HL)
+template <>
+bool CPU::opcode<0x35>(u16 operand) {
+  u8 val = mmu.read8(reg.hl);
+  decrementReg(val);
+  mmu.write8(reg.hl, val);
+  return true;
+}
 
-    // LD H, E
-    case 0x63:
-      reg.h = reg.e;
-      break;
+// LD (HL), nn
+template <>
+bool CPU::opcode<0x36>(u16 operand) {
+  mmu.write8(reg.hl, operand);
+  return true;
+}
 
-    // LD H, H
-    case 0x64:
-      // reg.h = reg.h;
-      break;
+// SCF
+template <>
+bool CPU::opcode<0x37>(u16 operand) {
+  syncFlags();
+  bitClear(reg.f, FLAG_SUBTRACT);
+  bitClear(reg.f, FLAG_HALF_CARRY);
+  bitSet(reg.f, FLAG_CARRY);
+  return true;
+}
 
-    // LD H, L
-    case 0x65:
-      reg.h = reg.l;
-      break;
+// JR C, 0x%02X
+template <>
+bool CPU::opcode<0x38>(u16 operand) {
+  if (flagC()) {
+    cpu_clock_t += 4;
+    reg.pc += (s8)operand;
+  }
+  return true;
+}
 
-    // LD H, (HL)
-    case 0x66:
-      reg.h = mmu.read8(reg.hl);
-      break;
+// ADD HL, SP
+template <>
+bool CPU::opcode<0x39>(u16 operand) {
+  add16(reg.hl, reg.sp);
+  return true;
+}
 
-    // LD H, A
-    case 0x67:
-      reg.h = reg.a;
-      break;
+// LDD A, (HL)
+template <>
+bool CPU::opcode<0x3A>(u16 operand) {
+  reg.a = mmu.read8(reg.hl--);
+  return true;
+}
 
-    // LD L, B
-    case 0x68:
-      reg.l = reg.b;
-      break;
+// DEC SP
+// Flags are not affected by 16bit decrement
+template <>
+bool CPU::opcode<0x3B>(u16 operand) {
+  reg.sp--;
+  return true;
+}
 
-    // LD L, C
-    case 0x69:
-      reg.l = reg.c;
-      break;
+// INC A
+template <>
+bool CPU::opcode<0x3C>(u16 operand) {
+  incrementReg(reg.a);
+  return true;
+}
 
-    // LD L, D
-    case 0x6A:
-      reg.l = reg.d;
-      break;
+// DEC A
+template <>
+bool CPU::opcode<0x3D>(u16 operand) {
+  decrementReg(reg.a);
+  return true;
+}
 
-    // LD L, E
-    case 0x6B:
-      reg.l = reg.e;
-      break;
+// LD A, nn
+template <>
+bool CPU::opcode<0x3E>(u16 operand) {
+  reg.a = operand;
+  return true;
+}
 
-    // LD L, H
-    case 0x6C:
-      reg.l = reg.h;
-      break;
+// CCF
+// Complement carry flag
+template <>
+bool CPU::opcode<0x3F>(u16 operand) {
+  syncFlags();
+  bitClear(reg.f, FLAG_SUBTRACT);
+  bitClear(reg.f, FLAG_HALF_CARRY);
+  if (flagC()) {
+    bitClear(reg.f, FLAG_CARRY);
+  } else {
+    bitSet(reg.f, FLAG_CARRY);
+  }
+  return true;
+}
 
-    // LD L, L
-    case 0x6D:
-      // reg.l = reg.l;
-      break;
+// HALT
+template <>
+bool CPU::opcode<0x76>(u16 operand) {
+  // todo: HALT bug, when IME is off and an interrupt is already pending
+  halted = true;
+  return true;
+}
 
-    // LD L, (HL)
-    case 0x6E:
-      reg.l = mmu.read8(reg.hl);
-      break;
+// RET NZ
+template <>
+bool CPU::opcode<0xC0>(u16 operand) {
+  if (!flagZ()) {
+    reg.pc = mmu.read16(reg.sp);
+    reg.sp += 2;
+    cpu_clock_t += 12;
+  }
+  return true;
+}
 
-    // LD L, A
-    case 0x6F:
-      reg.l = reg.a;
-      break;
+// POP BC
+template <>
+bool CPU::opcode<0xC1>(u16 operand) {
+  reg.bc = mmu.read16(reg.sp);
+  reg.sp += 2;
+  return true;
+}
 
-    // LD (HL), B
-    case 0x70:
-      mmu.write8(reg.hl, reg.b);
-      break;
+// JP NZ, 0x%04X
+template <>
+bool CPU::opcode<0xC2>(u16 operand) {
+  if (!flagZ()) {
+    reg.pc = operand;
+    cpu_clock_t += 4;
+  }
+  return true;
+}
 
-    // LD (HL), C
-    case 0x71:
-      mmu.write8(reg.hl, reg.c);
-      break;
+// JP nnnn
+template <>
+bool CPU::opcode<0xC3>(u16 operand) {
+  reg.pc = operand;
+  return true;
+}
 
-    // LD (HL), D
-    case 0x72:
-      mmu.write8(reg.hl, reg.d);
-      break;
+// CALL NZ, 0x%04X
+template <>
+bool CPU::opcode<0xC4>(u16 operand) {
+  if (!flagZ()) {
+    cpu_clock_t += 12;
+    reg.sp -= 2;
+    mmu.write16(reg.sp, reg.pc);
+    reg.pc = operand;
+  }
+  return true;
+}
 
-    // LD (HL), E
-    case 0x73:
-      mmu.write8(reg.hl, reg.e);
-      break;
+// PUSH BC
+template <>
+bool CPU::opcode<0xC5>(u16 operand) {
+  reg.sp -= 2;
+  mmu.write16(reg.sp, reg.bc);
+  return true;
+}
 
-    // LD (HL), H
-    case 0x74:
-      mmu.write8(reg.hl, reg.h);
-      break;
+// ADD A, 0x%02X
+template <>
+bool CPU::opcode<0xC6>(u16 operand) {
+  add(operand);
+  return true;
+}
 
-    // LD (HL), L
-    case 0x75:
-      mmu.write8(reg.hl, reg.l);
-      break;
+// RST 0x00
+template <>
+bool CPU::opcode<0xC7>(u16 operand) {
+  reg.pc = 0x00;
+  return true;
+}
 
-    // HALT
-    case 0x76:
-      std::cout << "Todo: 0x76 Halt\n";
-      return false;
-      break;
+// RET Z
+template <>
+bool CPU::opcode<0xC8>(u16 operand) {
+  if (flagZ()) {
+    reg.pc = mmu.read16(reg.sp);
+    reg.sp += 2;
+    cpu_clock_t += 12;
+  }
+  return true;
+}
 
-    // LD (HL), A
-    case 0x77:
-      mmu.write8(reg.hl, reg.a);
-      break;
+// RET
+template <>
+bool CPU::opcode<0xC9>(u16 operand) {
+  reg.pc = mmu.read16(reg.sp);
+  reg.sp += 2;
+  return true;
+}
 
-    // LD A, B
-    case 0x78:
-      reg.a = reg.b;
-      break;
+// JP Z, 0x%04X
+template <>
+bool CPU::opcode<0xCA>(u16 operand) {
+  if (flagZ()) {
+    reg.pc = operand;
+    cpu_clock_t += 4;
+  }
+  return true;
+}
 
-    // LD A, C
-    case 0x79:
-      reg.a = reg.c;
-      break;
+// CB is a prefix
+template <>
+bool CPU::opcode<0xCB>(u16 operand) {
+  if (!execute_CB(operand)) {
+    return false;
+  }
+  cpu_clock_t = instructions_CB[operand].cycles;
+  return true;
+}
 
-    // LD A, D
-    case 0x7A:
-      reg.a = reg.d;
-      break;
+// CALL Z, 0x%04X
+template <>
+bool CPU::opcode<0xCC>(u16 operand) {
+  if (flagZ()) {
+    cpu_clock_t += 12;
+    reg.sp -= 2;
+    mmu.write16(reg.sp, reg.pc);
+    reg.pc = operand;
+  }
+  return true;
+}
 
-    // LD A, E
-    case 0x7B:
-      reg.a = reg.e;
-      break;
+// CALL nnnn
+template <>
+bool CPU::opcode<0xCD>(u16 operand) {
+  reg.sp -= 2;
+  mmu.write16(reg.sp, reg.pc);
+  reg.pc = operand;
+  return true;
+}
 
-    // LD A, H
-    case 0x7C:
-      reg.a = reg.h;
-      break;
+// ADC 0x%02X
+template <>
+bool CPU::opcode<0xCE>(u16 operand) {
+  addCarry(operand);
+  return true;
+}
 
-    // LD A, L
-    case 0x7D:
-      reg.a = reg.l;
-      break;
+// RST 0x08
+template <>
+bool CPU::opcode<0xCF>(u16 operand) {
+  reg.pc = 0x08;
+  return true;
+}
 
-    // LD A, (HL)
-    case 0x7E:
-      reg.a = mmu.read8(reg.hl);
-      break;
+// RET NC
+template <>
+bool CPU::opcode<0xD0>(u16 operand) {
+  if (!flagC()) {
+    cpu_clock_t += 12;
+    reg.pc = mmu.read16(reg.sp);
+    reg.sp += 2;
+  }
+  return true;
+}
 
-    // LD A, A
-    case 0x7F:
-      // reg.a = reg.a;
-      break;
-
-    // ADD A, B
-    case 0x80:
-      add(reg.b);
-      break;
-
-    // ADD A, C
-    case 0x81:
-      add(reg.c);
-      break;
-
-    // ADD A, D
-    case 0x82:
-      add(reg.d);
-      break;
-
-    // ADD A, E
-    case 0x83:
-      add(reg.e);
-      break;
-
-    // ADD A, H
-    case 0x84:
-      add(reg.h);
-      break;
-
-    // ADD A, L
-    case 0x85:
-      add(reg.l);
-      break;
-
-    // ADD A, (HL)
-    case 0x86:
-      add(mmu.read8(reg.hl));
-      break;
-
-    // ADD A
-    case 0x87:
-      add(reg.a);
-      break;
-
-    // ADC B
-    case 0x88:
-      addCarry(reg.b);
-      break;
-
-    // ADC C
-    case 0x89:
-      addCarry(reg.c);
-      break;
-
-    // ADC D
-    case 0x8A:
-      addCarry(reg.d);
-      break;
-
-    // ADC E
-    case 0x8B:
-      addCarry(reg.e);
-      break;
-
-    // ADC H
-    case 0x8C:
-      addCarry(reg.h);
-      break;
-
-    // ADC L
-    case 0x8D:
-      addCarry(reg.l);
-      break;
-
-    // ADC (HL)
-    case 0x8E:
-      addCarry(mmu.read8(reg.hl));
-      break;
-
-    // ADC A
-    case 0x8F:
-      addCarry(reg.a);
-      break;
-
-    // SUB B
-    case 0x90:
-      subtract(reg.b);
-      break;
-
-    // SUB C
-    case 0x91:
-      subtract(reg.c);
-      break;
-
-    // SUB D
-    case 0x92:
-      subtract(reg.d);
-      break;
-
-    // SUB E
-    case 0x93:
-      subtract(reg.e);
-      break;
-
-    // SUB H
-    case 0x94:
-      subtract(reg.h);
-      break;
-
-    // SUB L
-    case 0x95:
-      subtract(reg.l);
-      break;
-
-    // SUB (HL)
-    case 0x96:
-      subtract(mmu.read8(reg.hl));
-      break;
-
-    // SUB A
-    case 0x97:
-      subtract(reg.a);
-      break;
-
-    // SBC B
-    case 0x98:
-      subtractCarry(reg.b);
-      break;
-
-    // SBC C
-    case 0x99:
-      subtractCarry(reg.c);
-      break;
-
-    // SBC D
-    case 0x9A:
-      subtractCarry(reg.d);
-      break;
-
-    // SBC E
-    case 0x9B:
-      subtractCarry(reg.e);
-      break;
-
-    // SBC H
-    case 0x9C:
-      subtractCarry(reg.h);
-      break;
-
-    // SBC L
-    case 0x9D:
-      subtractCarry(reg.l);
-      break;
-
-    // SBC (HL)
-    case 0x9E:
-      subtractCarry(mmu.read8(reg.hl));
-      break;
-
-    // SBC A
-    case 0x9F:
-      subtractCarry(reg.a);
-      break;
-
-    // AND B
-    case 0xA0:
-      andReg(reg.b);
-      break;
-
-    // AND C
-    case 0xA1:
-      andReg(reg.c);
-      break;
-
-    // AND D
-    case 0xA2:
-      andReg(reg.d);
-      break;
-
-    // AND E
-    case 0xA3:
-      andReg(reg.e);
-      break;
-
-    // AND H
-    case 0xA4:
-      andReg(reg.h);
-      break;
-
-    // AND L
-    case 0xA5:
-      andReg(reg.l);
-      break;
-
-    // AND (HL)
-    case 0xA6:
-      andReg(mmu.read8(reg.hl));
-      break;
-
-    // AND A
-    case 0xA7:
-      andReg(reg.a);
-      break;
-
-    // XOR B
-    case 0xA8:
-      xorReg(reg.b);
-      break;
-
-    // XOR C
-    case 0xA9:
-      xorReg(reg.c);
-      break;
-
-    // XOR D
-    case 0xAA:
-      xorReg(reg.d);
-      break;
-
-    // XOR E
-    case 0xAB:
-      xorReg(reg.e);
-      break;
-
-    // XOR H
-    case 0xAC:
-      xorReg(reg.h);
-      break;
-
-    // XOR L
-    case 0xAD:
-      xorReg(reg.l);
-      break;
-
-    // XOR (HL)
-    case 0xAE:
-      xorReg(mmu.read8(reg.hl));
-      break;
-
-    // XOR A
-    /* Compares each bit of its first operand to the corresponding bit of its
-      second operand. If one bit is 0 and the other bit is 1, the corresponding
-      result bit is set to 1. Otherwise, the corresponding result bit is set to
-      0.*/
-    case 0xAF:
-      xorReg(reg.a);
-      break;
-
-    // OR B
-    case 0xB0:
-      orReg(reg.b);
-      break;
-
-    // OR C
-    case 0xB1:
-      orReg(reg.c);
-      break;
-
-    // OR D
-    case 0xB2:
-      orReg(reg.d);
-      break;
-
-    // OR E
-    case 0xB3:
-      orReg(reg.e);
-      break;
-
-    // OR H
-    case 0xB4:
-      orReg(reg.h);
-      break;
-
-    // OR L
-    case 0xB5:
-      orReg(reg.l);
-      break;
-
-    // OR (HL)
-    case 0xB6:
-      orReg(mmu.read8(reg.hl));
-      break;
-
-    // OR A
-    case 0xB7:
-      orReg(reg.a);
-      break;
-
-    // CP B
-    case 0xB8:
-      compare(reg.b);
-      break;
-
-    // CP C
-    case 0xB9:
-      compare(reg.c);
-      break;
-
-    // CP D
-    case 0xBA:
-      compare(reg.d);
-      break;
-
-    // CP E
-    case 0xBB:
-      compare(reg.e);
-      break;
-
-    // CP H
-    case 0xBC:
-      compare(reg.h);
-      break;
-
-    // CP L
-    case 0xBD:
-      compare(reg.l);
-      break;
-
-    // CP (HL)
-    case 0xBE:
-      compare(mmu.read8(reg.hl));
-      break;
-
-    // CP A
-    case 0xBF:
-      compare(reg.a);
-      break;
-
-    // RET NZ
-    case 0xC0:
-      if (!bitTest(reg.f, FLAG_ZERO)) {
-        reg.pc = mmu.read16(reg.sp);
-        reg.sp += 2;
-        cpu_clock_t += 12;
-      }
-      break;
-
-    // POP BC
-    case 0xC1:
-      reg.bc = mmu.read16(reg.sp);
-      reg.sp += 2;
-      break;
-
-    // JP NZ, 0x%04X
-    case 0xC2:
-      if (!bitTest(reg.f, FLAG_ZERO)) {
-        reg.pc = operand;
-        cpu_clock_t += 4;
-      }
-      break;
-
-    // JP nnnn
-    case 0xC3:
-      reg.pc = operand;
-      break;
-
-    // CALL NZ, 0x%04X
-    case 0xC4:
-      if (!bitTest(reg.f, FLAG_ZERO)) {
-        cpu_clock_t += 12;
-        reg.sp -= 2;
-        mmu.write16(reg.sp, reg.pc);
-        reg.pc = operand;
-      }
-      break;
-
-    // PUSH BC
-    case 0xC5:
-      reg.sp -= 2;
-      mmu.write16(reg.sp, reg.bc);
-      break;
-
-    // ADD A, 0x%02X
-    case 0xC6:
-      add(operand);
-      break;
-
-    // RST 0x00
-    case 0xC7:
-      reg.pc = 0x00;
-      break;
-
-    // RET Z
-    case 0xC8:
-      if (bitTest(reg.f, FLAG_ZERO)) {
-        reg.pc = mmu.read16(reg.sp);
-        reg.sp += 2;
-        cpu_clock_t += 12;
-      }
-      break;
-
-    // RET
-    case 0xC9:
-      reg.pc = mmu.read16(reg.sp);
-      reg.sp += 2;
-      break;
-
-    // JP Z, 0x%04X
-    case 0xCA:
-      if (bitTest(reg.f, FLAG_ZERO)) {
-        reg.pc = operand;
-        cpu_clock_t += 4;
-      }
-      break;
-
-    // CB is a prefix
-    case 0xCB:
-      if (!execute_CB(operand)) {
-        return false;
-      }
-      cpu_clock_t = instructions_CB[operand].cycles;
-      break;
-
-    // CALL Z, 0x%04X
-    case 0xCC:
-      if (bitTest(reg.f, FLAG_ZERO)) {
-        cpu_clock_t += 12;
-        reg.sp -= 2;
-        mmu.write16(reg.sp, reg.pc);
-        reg.pc = operand;
-      }
-      break;
-
-    // CALL nnnn
-    case 0xCD:
-      reg.sp -= 2;
-      mmu.write16(reg.sp, reg.pc);
-      reg.pc = operand;
-      break;
-
-    // ADC 0x%02X
-    case 0xCE:
-      addCarry(operand);
-      break;
-
-    // RST 0x08
-    case 0xCF:
-      reg.pc = 0x08;
-      break;
-
-    // RET NC
-    case 0xD0:
-      if (!bitTest(reg.f, FLAG_CARRY)) {
-        cpu_clock_t += 12;
-        reg.pc = mmu.read16(reg.sp);
-        reg.sp += 2;
-      }
-      break;
-
-    // POP DE
-    case 0xD1:
-      reg.de = mmu.read16(reg.sp);
-      reg.sp += 2;
-      break;
-
-    // JP NC, 0x%04X
-    case 0xD2:
-      if (!bitTest(reg.f, FLAG_CARRY)) {
-        cpu_clock_t += 4;
-        reg.pc = operand;
-      }
-      break;
-
-    // UNKNOWN
-    case 0xD3:
-      std::cout << "CPU: 0xD3 UNKNOWN\n";
-      return false;
-      break;
-
-    // CALL NC, 0x%04X
-    case 0xD4:
-      if (!bitTest(reg.f, FLAG_CARRY)) {
-        cpu_clock_t += 12;
-        reg.sp -= 2;
-        mmu.write16(reg.sp, reg.pc);
-        reg.pc = operand;
-      }
-      break;
-
-    // PUSH DE
-    case 0xD5:
-      reg.sp -= 2;
-      mmu.write16(reg.sp, reg.de);
-      break;
-
-    // SUB 0x%02X
-    case 0xD6:
-      subtract(operand);
-      break;
-
-    // RST 0x10
-    case 0xD7:
-      reg.pc = 0x10;
-      break;
-
-    // RET C
-    case 0xD8:
-      if (bitTest(reg.f, FLAG_CARRY)) {
-        cpu_clock_t += 12;
-        reg.pc = mmu.read16(reg.sp);
-        reg.sp += 2;
-      }
-      break;
-
-    // RETI
-    case 0xD9:
-      reg.pc = mmu.read16(reg.sp);
-      reg.sp += 2;
-      ime = true;
-      break;
-
-    // JP C, 0x%04X
-    case 0xDA:
-      if (bitTest(reg.f, FLAG_CARRY)) {
-        cpu_clock_t += 4;
-        reg.pc = operand;
-      }
-      break;
-
-    // UNKNOWN
-    case 0xDB:
-      std::cout << "CPU: 0xDB UNKNOWN\n";
-      return false;
-      break;
-
-    // CALL C, 0x%04X
-    case 0xDC:
-      if (bitTest(reg.f, FLAG_CARRY)) {
-        cpu_clock_t += 12;
-        reg.sp -= 2;
-        mmu.write16(reg.sp, reg.pc);
-        reg.pc = operand;
-      }
-      break;
-
-    // UNKNOWN
-    case 0xDD:
-      std::cout << "CPU: 0xDD UNKNOWN\n";
-      return false;
-      break;
-
-    // SBC 0x%02X
-    case 0xDE:
-      subtractCarry(operand);
-      break;
-
-    // RST 0x18
-    case 0xDF:
-      reg.pc = 0x18;
-      break;
-
-    // LDH (0xFF00 + nn), A
-    case 0xE0:
-      mmu.write8(0xFF00 + operand, reg.a);
-      break;
-
-    // POP HL
-    case 0xE1:
-      reg.hl = mmu.read16(reg.sp);
-      reg.sp += 2;
-      break;
-
-    // LD (0xFF00 + C), A
-    case 0xE2:
-      mmu.write8((0xFF00 + reg.c), reg.a);
-      break;
-
-    // UNKNOWN
-    case 0xE3:
-      std::cout << "CPU: 0xE3 UNKNOWN\n";
-      return false;
-      break;
-
-    // UNKNOWN
-    case 0xE4:
-      std::cout << "CPU: 0xE4 UNKNOWN\n";
-      return false;
-      break;
-
-    // PUSH HL
-    case 0xE5:
-      reg.sp -= 2;
-      mmu.write16(reg.sp, reg.hl);
-      break;
-
-    // AND nn
-    case 0xE6:
-      andReg(operand);
-      break;
-
-    // RST 0x20
-    case 0xE7:
-      reg.pc = 0x20;
-      break;
-
-    // ADD SP,0x%02X
-    case 0xE8:
-      bitClear(reg.f, FLAG_ZERO);
-      bitClear(reg.f, FLAG_SUBTRACT);
-      if ((reg.sp + (s8)operand) > 0xFF) {
-        bitSet(reg.f, FLAG_CARRY);
-      }
-      if ((reg.sp & 0xF) + ((s8)operand & 0xF) > 0xF) {
-        bitSet(reg.f, FLAG_HALF_CARRY);
-      }
-      break;
-
-    // JP HL
-    case 0xE9:
-      reg.pc = reg.hl;
-      break;
-
-    // LD (nnnn), A
-    case 0xEA:
-      mmu.write8(operand, reg.a);
-      break;
-
-    // UNKNOWN
-    case 0xEB:
-      std::cout << "CPU: 0xEB UNKNOWN\n";
-      return false;
-      break;
-
-    // UNKNOWN
-    case 0xEC:
-      std::cout << "CPU: 0xEC UNKNOWN\n";
-      return false;
-      break;
-
-    // UNKNOWN
-    case 0xED:
-      std::cout << "CPU: 0xED UNKNOWN\n";
-      return false;
-      break;
-
-    // XOR 0x%02X
-    case 0xEE:
-      xorReg(operand);
-      break;
-
-    // RST 0x28
-    case 0xEF:
-      reg.sp -= 2;
-      mmu.write16(reg.sp, reg.pc);
-      reg.pc = 0x28;
-      break;
-
-    // LDH A, (0xFF00 + nn)
-    case 0xF0:
-      reg.a = mmu.read8(0xFF00 + operand);
-      break;
-
-    // POP AF
-    case 0xF1:
-      // Only the top four bits of the f register are writable
-      reg.f = mmu.read8(reg.sp++) & 0xF0;
-      reg.a = mmu.read8(reg.sp++);
-      break;
-
-    // LD A, (0xFF00 + C)
-    case 0xF2:
-      reg.a = mmu.read8(0xFF00 + reg.c);
-      break;
-
-    // DI
-    case 0xF3:
-      ime = false;
-      break;
-
-    // UNKNOWN
-    case 0xF4:
-      std::cout << "CPU: 0xF4 UNKNOWN\n";
-      return false;
-      break;
-
-    // PUSH AF
-    case 0xF5:
-      reg.sp -= 2;
-      mmu.write16(reg.sp, reg.af);
-      break;
-
-    // OR 0x%02X
-    case 0xF6:
-      orReg(operand);
-      break;
-
-    // RST 0x30
-    case 0xF7:
-      reg.pc = 0x30;
-      break;
-
-    // LD HL, SP+0x%02X
-    case 0xF8:
-      reg.hl = reg.sp + operand;
-      break;
-
-    // LD SP, HL
-    case 0xF9:
-      reg.sp = reg.hl;
-      break;
-
-    // LD A, (nnnn)
-    case 0xFA:
-      reg.a = mmu.read8(operand);
-      break;
-
-    // EI
-    case 0xFB:
-      ime = true;
-      eiDelay = true;
-      break;
-
-    // UNKNOWN
-    case 0xFC:
-      std::cout << "CPU: 0xFC UNKNOWN\n";
-      return false;
-      break;
-
-    // UNKNOWN
-    case 0xFD:
-      std::cout << "CPU: 0xFD UNKNOWN\n";
-      return false;
-      break;
-
-    // CP nn
-    // Implied subtraction (A - nn) and set flags
-    case 0xFE:
-      compare(operand);
-      break;
-
-    // RST 0x38
-    case 0xFF:
-      reg.pc = 0x38;
-      break;
-
-    default:
-      return false;
-      break;
-  }
-  return true;
-}
-
-// Extended instruction set via 0xCB prefix
-bool CPU::execute_CB(u8 op) {
-  switch (op) {
-    // RLC B
-    case 0x00:
-      rotateLeftCarry(reg.b);
-      break;
-
-    // RLC C
-    case 0x01:
-      rotateLeftCarry(reg.c);
-      break;
-
-    // RLC D
-    case 0x02:
-      rotateLeftCarry(reg.d);
-      break;
-
-    // RLC E
-    case 0x03:
-      rotateLeftCarry(reg.e);
-      break;
-
-    // RLC H
-    case 0x04:
-      rotateLeftCarry(reg.h);
-      break;
-
-    // RLC L
-    case 0x05:
-      rotateLeftCarry(reg.l);
-      break;
-
-    // RLC (HL)
-    case 0x06: {
-      u8 val = mmu.read8(reg.hl);
-      rotateLeftCarry(val);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // RLC A
-    case 0x07:
-      rotateLeftCarry(reg.a);
-      break;
-
-    // RRC B
-    case 0x08:
-      rotateRightCarry(reg.b);
-      break;
-
-    // RRC C
-    case 0x09:
-      rotateRightCarry(reg.c);
-      break;
-
-    // RRC D
-    case 0x0A:
-      rotateRightCarry(reg.d);
-      break;
-
-    // RRC E
-    case 0x0B:
-      rotateRightCarry(reg.e);
-      break;
-
-    // RRC H
-    case 0x0C:
-      rotateRightCarry(reg.h);
-      break;
-
-    // RRC L
-    case 0x0D:
-      rotateRightCarry(reg.l);
-      break;
-
-    // RRC (HL)
-    case 0x0E: {
-      u8 val = mmu.read8(reg.hl);
-      rotateRightCarry(val);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // RRC A
-    case 0x0F:
-      rotateRightCarry(reg.a);
-      break;
-
-    // RL B
-    case 0x10:
-      rotateLeft(reg.b);
-      break;
-
-    // RL C
-    case 0x11:
-      rotateLeft(reg.c);
-      break;
-
-    // RL D
-    case 0x12:
-      rotateLeft(reg.d);
-      break;
-
-    // RL E
-    case 0x13:
-      rotateLeft(reg.e);
-      break;
-
-    // RL H
-    case 0x14:
-      rotateLeft(reg.h);
-      break;
-
-    // RL L
-    case 0x15:
-      rotateLeft(reg.l);
-      break;
-
-    // RL (HL)
-    case 0x16: {
-      u8 val = mmu.read8(reg.hl);
-      rotateLeft(val);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // RL A
-    case 0x17:
-      rotateLeft(reg.a);
-      break;
-
-    // RR B
-    case 0x18:
-      rotateRight(reg.b);
-      break;
-
-    // RR C
-    case 0x19:
-      rotateRight(reg.c);
-      break;
-
-    // RR D
-    case 0x1A:
-      rotateRight(reg.d);
-      break;
-
-    // RR E
-    case 0x1B:
-      rotateRight(reg.e);
-      break;
-
-    // RR H
-    case 0x1C:
-      rotateRight(reg.h);
-      break;
-
-    // RR L
-    case 0x1D:
-      rotateRight(reg.l);
-      break;
-
-    // RR (HL)
-    case 0x1E: {
-      u8 val = mmu.read8(reg.hl);
-      rotateRight(val);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // RR A
-    case 0x1F:
-      rotateRight(reg.a);
-      break;
-
-    // SLA B
-    case 0x20:
-      sla(reg.b);
-      break;
-
-    // SLA C
-    case 0x21:
-      sla(reg.c);
-      break;
-
-    // SLA D
-    case 0x22:
-      sla(reg.d);
-      break;
-
-    // SLA E
-    case 0x23:
-      sla(reg.e);
-      break;
-
-    // SLA H
-    case 0x24:
-      sla(reg.h);
-      break;
-
-    // SLA L
-    case 0x25:
-      sla(reg.l);
-      break;
-
-    // SLA (HL)
-    case 0x26: {
-      u8 val = mmu.read8(reg.hl);
-      sla(val);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // SLA A
-    case 0x27:
-      sla(reg.a);
-      break;
-
-    // SRA B
-    case 0x28:
-      sra(reg.b);
-      break;
-
-    // SRA C
-    case 0x29:
-      sra(reg.c);
-      break;
-
-    // SRA D
-    case 0x2A:
-      sra(reg.d);
-      break;
-
-    // SRA E
-    case 0x2B:
-      sra(reg.e);
-      break;
-
-    // SRA H
-    case 0x2C:
-      sra(reg.h);
-      break;
-
-    // SRA L
-    case 0x2D:
-      sra(reg.l);
-      break;
-
-    // SRA (HL)
-    case 0x2E: {
-      u8 val = mmu.read8(reg.hl);
-      sra(val);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // SRA A
-    case 0x2F:
-      sra(reg.b);
-      break;
-
-    // SWAP B
-    case 0x30:
-      swapReg(reg.b);
-      break;
-
-    // SWAP C
-    case 0x31:
-      swapReg(reg.c);
-      break;
-
-    // SWAP D
-    case 0x32:
-      swapReg(reg.d);
-      break;
-
-    // SWAP E
-    case 0x33:
-      swapReg(reg.e);
-      break;
-
-    // SWAP H
-    case 0x34:
-      swapReg(reg.h);
-      break;
-
-    // SWAP L
-    case 0x35:
-      swapReg(reg.l);
-      break;
-
-    // SWAP (HL)
-    case 0x36: {
-      u8 val = mmu.read8(reg.hl);
-      swapReg(val);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // SWAP A
-    case 0x37:
-      swapReg(reg.a);
-      break;
-
-    // SRL B
-    case 0x38:
-      srl(reg.b);
-      break;
-
-    // SRL C
-    case 0x39:
-      srl(reg.c);
-      break;
-
-    // SRL D
-    case 0x3A:
-      srl(reg.d);
-      break;
-
-    // SRL E
-    case 0x3B:
-      srl(reg.e);
-      break;
-
-    // SRL H
-    case 0x3C:
-      srl(reg.h);
-      break;
-
-    // SRL L
-    case 0x3D:
-      srl(reg.l);
-      break;
-
-    // SRL (HL)
-    case 0x3E: {
-      u8 val = mmu.read8(reg.hl);
-      srl(val);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // SRL A
-    case 0x3F:
-      srl(reg.a);
-      break;
-
-    // BIT 0, B
-    case 0x40:
-      bit(0, reg.b);
-      break;
-
-    // BIT 0, C
-    case 0x41:
-      bit(0, reg.c);
-      break;
-
-    // BIT 0, D
-    case 0x42:
-      bit(0, reg.d);
-      break;
-
-    // BIT 0, E
-    case 0x43:
-      bit(0, reg.e);
-      break;
-
-    // BIT 0, H
-    case 0x44:
-      bit(0, reg.h);
-      break;
-
-    // BIT 0, L
-    case 0x45:
-      bit(0, reg.l);
-      break;
-
-    // BIT 0, (HL)
-    case 0x46:
-      bit(0, mmu.read8(reg.hl));
-      break;
-
-    // BIT 0, A
-    case 0x47:
-      bit(0, reg.a);
-      break;
-
-    // BIT 1, B
-    case 0x48:
-      bit(1, reg.b);
-      break;
-
-    // BIT 1, C
-    case 0x49:
-      bit(1, reg.c);
-      break;
-
-    // BIT 1, D
-    case 0x4A:
-      bit(1, reg.d);
-      break;
-
-    // BIT 1, E
-    case 0x4B:
-      bit(1, reg.e);
-      break;
-
-    // BIT 1, H
-    case 0x4C:
-      bit(1, reg.h);
-      break;
-
-    // BIT 1, L
-    case 0x4D:
-      bit(1, reg.l);
-      break;
-
-    // BIT 1, (HL)
-    case 0x4E:
-      bit(1, mmu.read8(reg.hl));
-      break;
-
-    // BIT 1, A
-    case 0x4F:
-      bit(1, reg.a);
-      break;
-
-    // BIT 2, B
-    case 0x50:
-      bit(2, reg.b);
-      break;
-
-    // BIT 2, C
-    case 0x51:
-      bit(2, reg.c);
-      break;
-
-    // BIT 2, D
-    case 0x52:
-      bit(2, reg.d);
-      break;
-
-    // BIT 2, E
-    case 0x53:
-      bit(2, reg.e);
-      break;
-
-    // BIT 2, H
-    case 0x54:
-      bit(2, reg.h);
-      break;
-
-    // BIT 2, L
-    case 0x55:
-      bit(2, reg.l);
-      break;
-
-    // BIT 2, (HL)
-    case 0x56:
-      bit(2, mmu.read8(reg.hl));
-      break;
-
-    // BIT 2, A
-    case 0x57:
-      bit(2, reg.a);
-      break;
-
-    // BIT 3, B
-    case 0x58:
-      bit(3, reg.b);
-      break;
-
-    // BIT 3, C
-    case 0x59:
-      bit(3, reg.c);
-      break;
-
-    // BIT 3, D
-    case 0x5A:
-      bit(3, reg.d);
-      break;
-
-    // BIT 3, E
-    case 0x5B:
-      bit(3, reg.e);
-      break;
-
-    // BIT 3, H
-    case 0x5C:
-      bit(3, reg.h);
-      break;
-
-    // BIT 3, L
-    case 0x5D:
-      bit(3, reg.l);
-      break;
-
-    // BIT 3, (HL)
-    case 0x5E:
-      bit(3, mmu.read8(reg.hl));
-      break;
-
-    // BIT 3, A
-    case 0x5F:
-      bit(3, reg.a);
-      break;
-
-    // BIT 4, B
-    case 0x60:
-      bit(4, reg.b);
-      break;
-
-    // BIT 4, C
-    case 0x61:
-      bit(4, reg.c);
-      break;
-
-    // BIT 4, D
-    case 0x62:
-      bit(4, reg.d);
-      break;
-
-    // BIT 4, E
-    case 0x63:
-      bit(4, reg.e);
-      break;
-
-    // BIT 4, H
-    case 0x64:
-      bit(4, reg.h);
-      break;
-
-    // BIT 4, L
-    case 0x65:
-      bit(4, reg.l);
-      break;
-
-    // BIT 4, (HL)
-    case 0x66:
-      bit(4, mmu.read8(reg.hl));
-      break;
-
-    // BIT 4, A
-    case 0x67:
-      bit(4, reg.a);
-      break;
-
-    // BIT 5, B
-    case 0x68:
-      bit(5, reg.b);
-      break;
-
-    // BIT 5, C
-    case 0x69:
-      bit(5, reg.c);
-      break;
-
-    // BIT 5, D
-    case 0x6A:
-      bit(5, reg.d);
-      break;
-
-    // BIT 5, E
-    case 0x6B:
-      bit(5, reg.e);
-      break;
-
-    // BIT 5, H
-    case 0x6C:
-      bit(5, reg.h);
-      break;
-
-    // BIT 5, L
-    case 0x6D:
-      bit(5, reg.l);
-      break;
-
-    // BIT 5, (HL)
-    case 0x6E:
-      bit(5, mmu.read8(reg.hl));
-      break;
-
-    // BIT 5, A
-    case 0x6F:
-      bit(5, reg.a);
-      break;
-
-    // BIT 6, B
-    case 0x70:
-      bit(6, reg.b);
-      break;
-
-    // BIT 6, C
-    case 0x71:
-      bit(6, reg.c);
-      break;
-
-    // BIT 6, D
-    case 0x72:
-      bit(6, reg.d);
-      break;
-
-    // BIT 6, E
-    case 0x73:
-      bit(6, reg.e);
-      break;
-
-    // BIT 6, H
-    case 0x74:
-      bit(6, reg.h);
-      break;
-
-    // BIT 6, L
-    case 0x75:
-      bit(6, reg.l);
-      break;
-
-    // BIT 6, (HL)
-    case 0x76:
-      bit(6, mmu.read8(reg.hl));
-      break;
-
-    // BIT 6, A
-    case 0x77:
-      bit(6, reg.a);
-      break;
-
-    // BIT 7, B
-    case 0x78:
-      bit(7, reg.b);
-      break;
-
-    // BIT 7, C
-    case 0x79:
-      bit(7, reg.c);
-      break;
-
-    // BIT 7, D
-    case 0x7A:
-      bit(7, reg.d);
-      break;
-
-    // BIT 7, E
-    case 0x7B:
-      bit(7, reg.e);
-      break;
-
-    // BIT 7, H
-    case 0x7C:
-      bit(7, reg.h);
-      break;
-
-    // BIT 7, L
-    case 0x7D:
-      bit(7, reg.l);
-      break;
-
-    // BIT 7, (HL)
-    case 0x7E:
-      bit(7, mmu.read8(reg.hl));
-      break;
-
-    // BIT 7, A
-    case 0x7F:
-      bit(7, reg.a);
-      break;
-
-    // RES 0, B
-    case 0x80:
-      bitClear(reg.b, 0);
-      break;
-
-    // RES 0, C
-    case 0x81:
-      bitClear(reg.c, 0);
-      break;
-
-    // RES 0, D
-    case 0x82:
-      bitClear(reg.d, 0);
-      break;
-
-    // RES 0, E
-    case 0x83:
-      bitClear(reg.e, 0);
-      break;
-
-    // RES 0, H
-    case 0x84:
-      bitClear(reg.h, 0);
-      break;
-
-    // RES 0, L
-    case 0x85:
-      bitClear(reg.l, 0);
-      break;
-
-    // RES 0, (HL)
-    case 0x86: {
-      u8 val = mmu.read8(reg.hl);
-      bitClear(val, 0);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // RES 0, A
-    case 0x87:
-      bitClear(reg.a, 0);
-      break;
-
-    // RES 1, B
-    case 0x88:
-      bitClear(reg.b, 1);
-      break;
-
-    // RES 1, C
-    case 0x89:
-      bitClear(reg.c, 1);
-      break;
-
-    // RES 1, D
-    case 0x8A:
-      bitClear(reg.d, 1);
-      break;
-
-    // RES 1, E
-    case 0x8B:
-      bitClear(reg.e, 1);
-      break;
-
-    // RES 1, H
-    case 0x8C:
-      bitClear(reg.h, 1);
-      break;
-
-    // RES 1, L
-    case 0x8D:
-      bitClear(reg.l, 1);
-      break;
-
-    // RES 1, (HL)
-    case 0x8E: {
-      u8 val = mmu.read8(reg.hl);
-      bitClear(val, 1);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // RES 1, A
-    case 0x8F:
-      bitClear(reg.a, 1);
-      break;
-
-    // RES 2, B
-    case 0x90:
-      bitClear(reg.b, 2);
-      break;
-
-    // RES 2, C
-    case 0x91:
-      bitClear(reg.c, 2);
-      break;
-
-    // RES 2, D
-    case 0x92:
-      bitClear(reg.d, 2);
-      break;
-
-    // RES 2, E
-    case 0x93:
-      bitClear(reg.e, 2);
-      break;
-
-    // RES 2, H
-    case 0x94:
-      bitClear(reg.h, 2);
-      break;
-
-    // RES 2, L
-    case 0x95:
-      bitClear(reg.l, 2);
-      break;
-
-    // RES 2, (HL)
-    case 0x96: {
-      u8 val = mmu.read8(reg.hl);
-      bitClear(val, 2);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // RES 2, A
-    case 0x97:
-      bitClear(reg.a, 2);
-      break;
-
-    // RES 3, B
-    case 0x98:
-      bitClear(reg.b, 3);
-      break;
-
-    // RES 3, C
-    case 0x99:
-      bitClear(reg.c, 3);
-      break;
-
-    // RES 3, D
-    case 0x9A:
-      bitClear(reg.d, 3);
-      break;
-
-    // RES 3, E
-    case 0x9B:
-      bitClear(reg.e, 3);
-      break;
-
-    // RES 3, H
-    case 0x9C:
-      bitClear(reg.h, 3);
-      break;
-
-    // RES 3, L
-    case 0x9D:
-      bitClear(reg.l, 3);
-      break;
-
-    // RES 3, (HL)
-    case 0x9E: {
-      u8 val = mmu.read8(reg.hl);
-      bitClear(val, 3);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // RES 3, A
-    case 0x9F:
-      bitClear(reg.a, 3);
-      break;
-
-    // RES 4, B
-    case 0xA0:
-      bitClear(reg.b, 4);
-      break;
-
-    // RES 4, C
-    case 0xA1:
-      bitClear(reg.c, 4);
-      break;
-
-    // RES 4, D
-    case 0xA2:
-      bitClear(reg.d, 4);
-      break;
-
-    // RES 4, E
-    case 0xA3:
-      bitClear(reg.e, 4);
-      break;
-
-    // RES 4, H
-    case 0xA4:
-      bitClear(reg.h, 4);
-      break;
-
-    // RES 4, L
-    case 0xA5:
-      bitClear(reg.l, 4);
-      break;
-
-    // RES 4, (HL)
-    case 0xA6: {
-      u8 val = mmu.read8(reg.hl);
-      bitClear(val, 4);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // RES 4, A
-    case 0xA7:
-      bitClear(reg.a, 4);
-      break;
-
-    // RES 5, B
-    case 0xA8:
-      bitClear(reg.b, 5);
-      break;
-
-    // RES 5, C
-    case 0xA9:
-      bitClear(reg.c, 5);
-      break;
-
-    // RES 5, D
-    case 0xAA:
-      bitClear(reg.d, 5);
-      break;
-
-    // RES 5, E
-    case 0xAB:
-      bitClear(reg.e, 5);
-      break;
-
-    // RES 5, H
-    case 0xAC:
-      bitClear(reg.h, 5);
-      break;
-
-    // RES 5, L
-    case 0xAD:
-      bitClear(reg.l, 5);
-      break;
-
-    // RES 5, (HL)
-    case 0xAE: {
-      u8 val = mmu.read8(reg.hl);
-      bitClear(val, 5);
-      mmu.write8(reg.hl, val);
-    } break;
-
-    // RES 5, A
-    case 0xAF:
-      bitClear(reg.a, 5);
-      break;
-
-    // RES 6, B
-    case 0xB0:
-      bitClear(reg.b, 6);
-      break;
-
-    // RES 6, C
-    case 0xB1:
-      bitClear(reg.c, 6);
-      break;
+// POP DE
+template <>
+bool CPU::opcode<0xD1>(u16 operand) {
+  reg.de = mmu.read16(reg.sp);
+  reg.sp += 2;
+  return true;
+}
 
-    // RES 6, D
-    case 0xB2:
-      bitClear(reg.d, 6);
-      break;
+// JP NC, 0x%04X
+template <>
+bool CPU::opcode<0xD2>(u16 operand) {
+  if (!flagC()) {
+    cpu_clock_t += 4;
+    reg.pc = operand;
+  }
+  return true;
+}
 
-    // RES 6, E
-    case 0xB3:
-      bitClear(reg.e, 6);
-      break;
+// UNKNOWN
+template <>
+bool CPU::opcode<0xD3>(u16 operand) {
+  std::cout << "CPU: 0xD3 UNKNOWN\n";
+  return false;
+}
 
-    // RES 6, H
-    case 0xB4:
-      bitClear(reg.h, 6);
-      break;
+// CALL NC, 0x%04X
+template <>
+bool CPU::opcode<0xD4>(u16 operand) {
+  if (!flagC()) {
+    cpu_clock_t += 12;
+    reg.sp -= 2;
+    mmu.write16(reg.sp, reg.pc);
+    reg.pc = operand;
+  }
+  return true;
+}
 
-    // RES 6, L
-    case 0xB5:
-      bitClear(reg.l, 6);
-      break;
+// PUSH DE
+template <>
+bool CPU::opcode<0xD5>(u16 operand) {
+  reg.sp -= 2;
+  mmu.write16(reg.sp, reg.de);
+  return true;
+}
 
-    // RES 6, (HL)
-    case 0xB6: {
-      u8 val = mmu.read8(reg.hl);
-      bitClear(val, 6);
-      mmu.write8(reg.hl, val);
-    } break;
+// SUB 0x%02X
+template <>
+bool CPU::opcode<0xD6>(u16 operand) {
+  subtract(operand);
+  return true;
+}
 
-    // RES 6, A
-    case 0xB7:
-      bitClear(reg.a, 6);
-      break;
+// RST 0x10
+template <>
+bool CPU::opcode<0xD7>(u16 operand) {
+  reg.pc = 0x10;
+  return true;
+}
 
-    // RES 7, B
-    case 0xB8:
-      bitClear(reg.b, 7);
-      break;
+// RET C
+template <>
+bool CPU::opcode<0xD8>(u16 operand) {
+  if (flagC()) {
+    cpu_clock_t += 12;
+    reg.pc = mmu.read16(reg.sp);
+    reg.sp += 2;
+  }
+  return true;
+}
 
-    // RES 7, C
-    case 0xB9:
-      bitClear(reg.c, 7);
-      break;
+// RETI
+template <>
+bool CPU::opcode<0xD9>(u16 operand) {
+  reg.pc = mmu.read16(reg.sp);
+  reg.sp += 2;
+  ime = true;
+  return true;
+}
 
-    // RES 7, D
-    case 0xBA:
-      bitClear(reg.d, 7);
-      break;
+// JP C, 0x%04X
+template <>
+bool CPU::opcode<0xDA>(u16 operand) {
+  if (flagC()) {
+    cpu_clock_t += 4;
+    reg.pc = operand;
+  }
+  return true;
+}
 
-    // RES 7, E
-    case 0xBB:
-      bitClear(reg.e, 7);
-      break;
+// UNKNOWN
+template <>
+bool CPU::opcode<0xDB>(u16 operand) {
+  std::cout << "CPU: 0xDB UNKNOWN\n";
+  return false;
+}
 
-    // RES 7, H
-    case 0xBC:
-      bitClear(reg.h, 7);
-      break;
+// CALL C, 0x%04X
+template <>
+bool CPU::opcode<0xDC>(u16 operand) {
+  if (flagC()) {
+    cpu_clock_t += 12;
+    reg.sp -= 2;
+    mmu.write16(reg.sp, reg.pc);
+    reg.pc = operand;
+  }
+  return true;
+}
 
-    // RES 7, L
-    case 0xBD:
-      bitClear(reg.l, 7);
-      break;
+// UNKNOWN
+template <>
+bool CPU::opcode<0xDD>(u16 operand) {
+  std::cout << "CPU: 0xDD UNKNOWN\n";
+  return false;
+}
 
-    // RES 7, (HL)
-    case 0xBE: {
-      u8 val = mmu.read8(reg.hl);
-      bitClear(val, 7);
-      mmu.write8(reg.hl, val);
-    } break;
+// SBC 0x%02X
+template <>
+bool CPU::opcode<0xDE>(u16 operand) {
+  subtractCarry(operand);
+  return true;
+}
 
-    // RES 7, A
-    case 0xBF:
-      bitClear(reg.a, 7);
-      break;
+// RST 0x18
+template <>
+bool CPU::opcode<0xDF>(u16 operand) {
+  reg.pc = 0x18;
+  return true;
+}
 
-    // SET 0, B
-    case 0xC0:
-      bitSet(reg.b, 0);
-      break;
+// LDH (0xFF00 + nn), A
+template <>
+bool CPU::opcode<0xE0>(u16 operand) {
+  mmu.write8(0xFF00 + operand, reg.a);
+  return true;
+}
 
-    // SET 0, C
-    case 0xC1:
-      bitSet(reg.c, 0);
-      break;
+// POP HL
+template <>
+bool CPU::opcode<0xE1>(u16 operand) {
+  reg.hl = mmu.read16(reg.sp);
+  reg.sp += 2;
+  return true;
+}
 
-    // SET 0, D
-    case 0xC2:
-      bitSet(reg.d, 0);
-      break;
+// LD (0xFF00 + C), A
+template <>
+bool CPU::opcode<0xE2>(u16 operand) {
+  mmu.write8((0xFF00 + reg.c), reg.a);
+  return true;
+}
 
-    // SET 0, E
-    case 0xC3:
-      bitSet(reg.e, 0);
-      break;
+// UNKNOWN
+template <>
+bool CPU::opcode<0xE3>(u16 operand) {
+  std::cout << "CPU: 0xE3 UNKNOWN\n";
+  return false;
+}
 
-    // SET 0, H
-    case 0xC4:
-      bitSet(reg.h, 0);
-      break;
+// UNKNOWN
+template <>
+bool CPU::opcode<0xE4>(u16 operand) {
+  std::cout << "CPU: 0xE4 UNKNOWN\n";
+  return false;
+}
 
-    // SET 0, L
-    case 0xC5:
-      bitSet(reg.l, 0);
-      break;
+// PUSH HL
+template <>
+bool CPU::opcode<0xE5>(u16 operand) {
+  reg.sp -= 2;
+  mmu.write16(reg.sp, reg.hl);
+  return true;
+}
 
-    // SET 0, (HL)
-    case 0xC6: {
-      u8 val = mmu.read8(reg.hl);
-      bitSet(val, 0);
-      mmu.write8(reg.hl, val);
-    } break;
+// AND nn
+template <>
+bool CPU::opcode<0xE6>(u16 operand) {
+  andReg(operand);
+  return true;
+}
 
-    // SET 0, A
-    case 0xC7:
-      bitSet(reg.a, 0);
-      break;
+// RST 0x20
+template <>
+bool CPU::opcode<0xE7>(u16 operand) {
+  reg.pc = 0x20;
+  return true;
+}
 
-    // SET 1, B
-    case 0xC8:
-      bitSet(reg.b, 1);
-      break;
+// ADD SP,0x%02X
+template <>
+bool CPU::opcode<0xE8>(u16 operand) {
+  syncFlags();
+  bitClear(reg.f, FLAG_ZERO);
+  bitClear(reg.f, FLAG_SUBTRACT);
+  if ((reg.sp + (s8)operand) > 0xFF) {
+    bitSet(reg.f, FLAG_CARRY);
+  }
+  if ((reg.sp & 0xF) + ((s8)operand & 0xF) > 0xF) {
+    bitSet(reg.f, FLAG_HALF_CARRY);
+  }
+  return true;
+}
 
-    // SET 1, C
-    case 0xC9:
-      bitSet(reg.c, 1);
-      break;
+// JP HL
+template <>
+bool CPU::opcode<0xE9>(u16 operand) {
+  reg.pc = reg.hl;
+  return true;
+}
 
-    // SET 1, D
-    case 0xCA:
-      bitSet(reg.d, 1);
-      break;
+// LD (nnnn), A
+template <>
+bool CPU::opcode<0xEA>(u16 operand) {
+  mmu.write8(operand, reg.a);
+  return true;
+}
 
-    // SET 1, E
-    case 0xCB:
-      bitSet(reg.e, 1);
-      break;
+// UNKNOWN
+template <>
+bool CPU::opcode<0xEB>(u16 operand) {
+  std::cout << "CPU: 0xEB UNKNOWN\n";
+  return false;
+}
 
-    // SET 1, H
-    case 0xCC:
-      bitSet(reg.h, 1);
-      break;
+// UNKNOWN
+template <>
+bool CPU::opcode<0xEC>(u16 operand) {
+  std::cout << "CPU: 0xEC UNKNOWN\n";
+  return false;
+}
 
-    // SET 1, L
-    case 0xCD:
-      bitSet(reg.l, 1);
-      break;
+// UNKNOWN
+template <>
+bool CPU::opcode<0xED>(u16 operand) {
+  std::cout << "CPU: 0xED UNKNOWN\n";
+  return false;
+}
 
-    // SET 1, (HL)
-    case 0xCE: {
-      u8 val = mmu.read8(reg.hl);
-      bitSet(val, 1);
-      mmu.write8(reg.hl, val);
-    } break;
+// XOR 0x%02X
+template <>
+bool CPU::opcode<0xEE>(u16 operand) {
+  xorReg(operand);
+  return true;
+}
 
-    // SET 1, A
-    case 0xCF:
-      bitSet(reg.a, 1);
-      break;
+// RST 0x28
+template <>
+bool CPU::opcode<0xEF>(u16 operand) {
+  reg.sp -= 2;
+  mmu.write16(reg.sp, reg.pc);
+  reg.pc = 0x28;
+  return true;
+}
 
-    // SET 2, B
-    case 0xD0:
-      bitSet(reg.b, 2);
-      break;
+// LDH A, (0xFF00 + nn)
+template <>
+bool CPU::opcode<0xF0>(u16 operand) {
+  reg.a = mmu.read8(0xFF00 + operand);
+  return true;
+}
 
-    // SET 2, C
-    case 0xD1:
-      bitSet(reg.c, 2);
-      break;
+// POP AF
+template <>
+bool CPU::opcode<0xF1>(u16 operand) {
+  // Only the top four bits of the f register are writable
+  clearFlags();
+  reg.f = mmu.read8(reg.sp++) & 0xF0;
+  reg.a = mmu.read8(reg.sp++);
+  return true;
+}
 
-    // SET 2, D
-    case 0xD2:
-      bitSet(reg.d, 2);
-      break;
+// LD A, (0xFF00 + C)
+template <>
+bool CPU::opcode<0xF2>(u16 operand) {
+  reg.a = mmu.read8(0xFF00 + reg.c);
+  return true;
+}
 
-    // SET 2, E
-    case 0xD3:
-      bitSet(reg.e, 2);
-      break;
+// DI
+template <>
+bool CPU::opcode<0xF3>(u16 operand) {
+  ime = false;
+  return true;
+}
 
-    // SET 2, H
-    case 0xD4:
-      bitSet(reg.h, 2);
-      break;
+// UNKNOWN
+template <>
+bool CPU::opcode<0xF4>(u16 operand) {
+  std::cout << "CPU: 0xF4 UNKNOWN\n";
+  return false;
+}
 
-    // SET 2, L
-    case 0xD5:
-      bitSet(reg.l, 2);
-      break;
+// PUSH AF
+template <>
+bool CPU::opcode<0xF5>(u16 operand) {
+  syncFlags();
+  reg.sp -= 2;
+  mmu.write16(reg.sp, reg.af);
+  return true;
+}
 
-    // SET 2, (HL)
-    case 0xD6: {
-      u8 val = mmu.read8(reg.hl);
-      bitSet(val, 2);
-      mmu.write8(reg.hl, val);
-    } break;
+// OR 0x%02X
+template <>
+bool CPU::opcode<0xF6>(u16 operand) {
+  orReg(operand);
+  return true;
+}
 
-    // SET 2, A
-    case 0xD7:
-      bitSet(reg.a, 2);
-      break;
+// RST 0x30
+template <>
+bool CPU::opcode<0xF7>(u16 operand) {
+  reg.pc = 0x30;
+  return true;
+}
 
-    // SET 3, B
-    case 0xD8:
-      bitSet(reg.b, 3);
-      break;
+// LD HL, SP+0x%02X
+template <>
+bool CPU::opcode<0xF8>(u16 operand) {
+  reg.hl = reg.sp + operand;
+  return true;
+}
 
-    // SET 3, C
-    case 0xD9:
-      bitSet(reg.c, 3);
-      break;
+// LD SP, HL
+template <>
+bool CPU::opcode<0xF9>(u16 operand) {
+  reg.sp = reg.hl;
+  return true;
+}
 
-    // SET 3, D
-    case 0xDA:
-      bitSet(reg.d, 3);
-      break;
+// LD A, (nnnn)
+template <>
+bool CPU::opcode<0xFA>(u16 operand) {
+  reg.a = mmu.read8(operand);
+  return true;
+}
 
-    // SET 3, E
-    case 0xDB:
-      bitSet(reg.e, 3);
-      break;
+// EI
+template <>
+bool CPU::opcode<0xFB>(u16 operand) {
+  ime = true;
+  eiDelay = true;
+  return true;
+}
 
-    // SET 3, H
-    case 0xDC:
-      bitSet(reg.h, 3);
-      break;
+// UNKNOWN
+template <>
+bool CPU::opcode<0xFC>(u16 operand) {
+  std::cout << "CPU: 0xFC UNKNOWN\n";
+  return false;
+}
 
-    // SET 3, L
-    case 0xDD:
-      bitSet(reg.l, 3);
-      break;
+// UNKNOWN
+template <>
+bool CPU::opcode<0xFD>(u16 operand) {
+  std::cout << "CPU: 0xFD UNKNOWN\n";
+  return false;
+}
 
-    // SET 3, (HL)
-    case 0xDE: {
-      u8 val = mmu.read8(reg.hl);
-      bitSet(val, 3);
-      mmu.write8(reg.hl, val);
-    } break;
+// CP nn
+// Implied subtraction (A - nn) and set flags
+template <>
+bool CPU::opcode<0xFE>(u16 operand) {
+  compare(operand);
+  return true;
+}
 
-    // SET 3, A
-    case 0xDF:
-      bitSet(reg.a, 3);
-      break;
+// RST 0x38
+template <>
+bool CPU::opcode<0xFF>(u16 operand) {
+  reg.pc = 0x38;
+  return true;
+}
 
-    // SET 4, B
-    case 0xE0:
-      bitSet(reg.b, 4);
-      break;
+// Handler tables, indexed by opcode. Used for dispatch on compilers without
+// computed goto.
+#define GB_HANDLER(op) &CPU::opcode<op>,
+#define GB_HANDLER_CB(op) &CPU::opcodeCB<op>,
+const CPU::Handler CPU::opcodeTable[256] = {GB_OPCODES(GB_HANDLER)};
+const CPU::HandlerCB CPU::opcodeTableCB[256] = {GB_OPCODES(GB_HANDLER_CB)};
+#undef GB_HANDLER
+#undef GB_HANDLER_CB
+
+// Memory accesses by opcode. Only the (HL) forms of CB-prefixed
+// instructions touch memory, and BIT only reads.
+template <u8 op, typename Readable, typename Writable>
+bool CPU::accessesPass(u32 operand, Readable readable,
+                       Writable writable) const {
+  bool reads = true;
+  if (op == 0x0A) {
+    reads = readable(reg.bc);
+  } else if (op == 0x1A) {
+    reads = readable(reg.de);
+  } else if (op == 0x2A || op == 0x3A || op == 0x34 || op == 0x35 ||
+             (op >= 0x40 && op <= 0xBF && (op & 7) == 6 && op != 0x76)) {
+    // LD r, (HL) and ALU (HL) forms
+    reads = readable(reg.hl);
+  } else if (op == 0xF0) {
+    reads = readable(0xFF00 + operand);
+  } else if (op == 0xF2) {
+    reads = readable(0xFF00 + reg.c);
+  } else if (op == 0xFA) {
+    reads = readable(operand);
+  } else if (op == 0xCB && (operand & 7) == 6) {
+    reads = readable(reg.hl);
+  }
+  bool writes = true;
+  if (op == 0x02) {
+    writes = writable(reg.bc);
+  } else if (op == 0x12) {
+    writes = writable(reg.de);
+  } else if (op == 0x22 || op == 0x32 || op == 0x34 || op == 0x35 ||
+             op == 0x36 || (op >= 0x70 && op <= 0x77)) {
+    writes = writable(reg.hl);
+  } else if (op == 0x08) {
+    writes = writable(operand) && writable(operand + 1);
+  } else if (op == 0xEA) {
+    writes = writable(operand);
+  } else if (op == 0xE0) {
+    writes = writable(0xFF00 + operand);
+  } else if (op == 0xE2) {
+    writes = writable(0xFF00 + reg.c);
+  } else if ((op & 0xCF) == 0xC5 || (op & 0xC7) == 0xC7 || op == 0xCD ||
+             ((op & 0xE7) == 0xC4)) {
+    // PUSH, RST, CALL
+    writes = writable(reg.sp - 1) && writable(reg.sp - 2);
+  } else if (op == 0xCB) {
+    // (HL) operand of a rotate, shift, RES or SET
+    if ((operand & 7) == 6 && (operand < 0x40 || operand >= 0x80)) {
+      writes = writable(reg.hl);
+    }
+  }
+  return reads && writes;
+}
 
-    // SET 4, C
-    case 0xE1:
-      bitSet(reg.c, 4);
-      break;
+// Superinstructions. With both handlers inlined into one function the
+// compiler can keep what the first leaves behind (A, lazy flags) in
+// registers for the second.
+//
+// Scheduler::now stays at the start of the pair, so if the second reads or
+// writes an I/O register it's left for the next execute() to run on its own.
+template <u8 op1, u8 op2>
+bool CPU::fused(u16 operand, const decodedOp &next) {
+  static_assert(fusable(op1, op2),
+                "superinstructions.hpp: pair can't be fused");
+  bool ok = opcode<op1>(operand);
+  auto untimed = [](u16 addr) { return addr < 0xFF00 || addr >= 0xFF80; };
+  if (!accessesPass<op2>(next.operand, untimed, untimed)) {
+    cursor--;
+    cursorPC -= next.length;
+    superinstructions--;
+#ifdef GB_PROFILE_PAIRS
+    pairCounts[op1 << 8 | op2]--;
+    lastOp = op1;
+#endif
+    return ok;
+  }
+  u32 cycles = cpu_clock_t;
+  reg.pc += next.length;
+  cpu_clock_t = next.cycles;
+  ok = opcode<op2>(next.operand) && ok;
+  cpu_clock_t += cycles;
+  return ok;
+}
 
-    // SET 4, D
-    case 0xE2:
-      bitSet(reg.d, 4);
-      break;
+#define GB_FUSED_HANDLER(op1, op2) &CPU::fused<op1, op2>,
+#define GB_FUSED_PAIR(op1, op2) {op1, op2},
+const CPU::FusedHandler CPU::fusedTable[] = {
+    nullptr, GB_FUSED_PAIRS(GB_FUSED_HANDLER)};
+const u8 CPU::fusedPairs[][2] = {{0, 0}, GB_FUSED_PAIRS(GB_FUSED_PAIR)};
+const u32 CPU::fusedCount = sizeof(fusedPairs) / sizeof(fusedPairs[0]);
+static_assert(sizeof(CPU::fusedPairs) / 2 <= 256, "too many superinstructions");
+#undef GB_FUSED_HANDLER
+#undef GB_FUSED_PAIR
+
+// Writes compiled code can't make without leaving it: MBC registers in the
+// ROM area, I/O and IE can change banks, timing or pending interrupts
+static bool jitWritable(u16 addr) {
+  return addr >= 0x8000 && (addr < 0xFF00 || (addr >= 0xFF80 && addr < 0xFFFF));
+}
 
-    // SET 4, E
-    case 0xE3:
-      bitSet(reg.e, 4);
-      break;
+// Reads compiled code can't make: Scheduler::now is only advanced between
+// runs of compiled code, so DIV and TIMA would be out of date. STAT and LY
+// only change at events, which end a run, unless the access is timed to a
+// later M-cycle.
+static bool jitReadable(u16 addr) {
+  if (Accuracy::memoryTiming && (addr == STAT || addr == LY)) {
+    return false;
+  }
+  return addr != DIV && addr != TIMA;
+}
 
-    // SET 4, H
-    case 0xE4:
-      bitSet(reg.h, 4);
-      break;
+// Execute one instruction for the JIT (see jit.cpp). Returns its cycles, or
+// 0 without touching any state if it reads somewhere jitReadable rejects or
+// writes somewhere jitWritable rejects.
+template <u8 op>
+u32 CPU::jitStep(CPU *cpu, u32 operand, u32 pc, u32 *budget) {
+  registers &reg = cpu->reg;
+  if (!cpu->accessesPass<op>(operand, jitReadable, jitWritable)) {
+    reg.pc = pc;
+    return 0;
+  }
 
-    // SET 4, L
-    case 0xE5:
-      bitSet(reg.l, 4);
-      break;
+  reg.pc = pc + 1 + cpu->instructions[op].operandLength;
+  cpu->cpu_clock_t = cpu->instructions[op].cycles;
+  cpu->opcode<op>(operand);
+  return cpu->cpu_clock_t;
+}
 
-    // SET 4, (HL)
-    case 0xE6: {
-      u8 val = mmu.read8(reg.hl);
-      bitSet(val, 4);
-      mmu.write8(reg.hl, val);
-    } break;
+#define GB_JIT_STEP(op) &CPU::jitStep<op>,
+const CPU::JitStep CPU::jitSteps[256] = {GB_OPCODES(GB_JIT_STEP)};
+#undef GB_JIT_STEP
+
+bool CPU::execute(int budget) {
+  // Halted until checkInterrupts() sees a request. Only the GPU, the timer
+  // and the joypad can make one, so skip ahead to the next scheduled event.
+  // The main loop handles joypad input and wakes us between steps.
+  if (halted) {
+    cpu_clock_t = std::max(budget, 4);
+    return true;
+  }
 
-    // SET 4, A
-    case 0xE7:
-      bitSet(reg.a, 4);
-      break;
+  if (debugToFile) {
+    budget = 0;  // log every instruction
+    syncFlags();
+    fout << std::setfill('0') << std::setw(4) << std::hex << reg.pc + 1 << ": "
+         << std::setfill('0') << std::setw(4) << " af=" << reg.af
+         << std::setfill('0') << std::setw(4) << " bc=" << reg.bc
+         << std::setfill('0') << std::setw(4) << " de=" << reg.de
+         << std::setfill('0') << std::setw(4) << " hl=" << reg.hl
+         << std::setfill('0') << std::setw(4) << " sp=" << reg.sp << std::endl;
+  }
+#ifdef GB_PROFILE_PAIRS
+  bool sequential = reg.pc == cursorPC;
+#endif
+  // Fetch the decoded instruction and advance PC. The cursor is followed as
+  // long as execution runs straight through the block it came from.
+  if (reg.pc != cursorPC || cacheGeneration != mmu.codeGeneration ||
+      !cursor->length) {
+    cursor = lookupBlock(reg.pc);
+  }
+  const decodedOp &d = *cursor++;
+  u8 op = d.op;
+  u16 operand = d.operand;
+  reg.pc += d.length;
+  cursorPC = reg.pc;
 
-    // SET 5, B
-    case 0xE8:
-      bitSet(reg.b, 5);
-      break;
+  // Update cpu clock
+  cpu_clock_t = d.cycles;
 
-    // SET 5, C
-    case 0xE9:
-      bitSet(reg.c, 5);
-      break;
+  // The instruction's read or write comes in its last M-cycle
+  if constexpr (Accuracy::memoryTiming) {
+    u8 cycles = op == 0xCB ? instructions_CB[operand].cycles : d.cycles;
+    mmu.accessOffset = cycles - 4;
+  }
 
-    // SET 5, D
-    case 0xEA:
-      bitSet(reg.d, 5);
-      break;
+#ifdef GB_PROFILE_PAIRS
+  if (sequential) {
+    pairCounts[lastOp << 8 | op]++;
+  }
+  lastOp = op;
+#endif
+
+  // Run both halves of a superinstruction if no event is due after the first
+  // and no interrupt is waiting for checkInterrupts(), which can only happen
+  // right after EI
+  if (fusedCount > 1 && d.fused && fuse && d.cycles < budget &&
+      !(ime && mmu.pending)) {
+    const decodedOp &next = *cursor++;
+    cursorPC += next.length;
+    superinstructions++;
+#ifdef GB_PROFILE_PAIRS
+    pairCounts[op << 8 | next.op]++;
+    lastOp = next.op;
+#endif
+    return (this->*fusedTable[d.fused])(operand, next);
+  }
 
-    // SET 5, E
-    case 0xEB:
-      bitSet(reg.e, 5);
-      break;
+  if (d.idle && idleSkip && budget > 0) {
+    return runIdleLoop(d, budget);
+  }
+  if (d.bulk && bulkCopy && budget > 0) {
+    return runBulkLoop(d, budget);
+  }
 
-    // SET 5, H
-    case 0xEC:
-      bitSet(reg.h, 5);
-      break;
+  // Go go go!
+#ifdef GB_COMPUTED_GOTO
+  // Jump straight to the handler's label; every label is its own indirect
+  // branch site with the handler inlined behind it.
+#define GB_LABEL(op) &&op_##op,
+#define GB_CASE(op) \
+  op_##op:          \
+  return opcode<op>(operand);
+  static const void *const labels[256] = {GB_OPCODES(GB_LABEL)};
+  goto *labels[op];
+  GB_OPCODES(GB_CASE)
+#undef GB_LABEL
+#undef GB_CASE
+#else
+  return (this->*opcodeTable[op])(operand);
+#endif
+}
 
-    // SET 5, L
-    case 0xED:
-      bitSet(reg.l, 5);
-      break;
+// Decode the instruction at pc
+CPU::decodedOp CPU::decode(u16 pc) {
+  decodedOp d;
+  d.op = mmu.fetch8(pc);
+  d.length = 1 + instructions[d.op].operandLength;
+  d.cycles = instructions[d.op].cycles;
+  d.operand = 0;
+  d.fused = 0;
+  d.idle = 0;
+  d.bulk = 0;
+  if (d.length == 2) {
+    d.operand = mmu.fetch8(pc + 1);
+  } else if (d.length == 3) {
+    d.operand = mmu.fetch8(pc + 2) << 8 | mmu.fetch8(pc + 1);
+  }
+  return d;
+}
 
-    // SET 5, (HL)
-    case 0xEE: {
-      u8 val = mmu.read8(reg.hl);
-      bitSet(val, 5);
-      mmu.write8(reg.hl, val);
-    } break;
+// Superinstruction index of the pair op1, op2, or 0 if it has none
+static u8 fusedIndex(u8 op1, u8 op2) {
+  for (u32 i = 1; i < CPU::fusedCount; i++) {
+    if (CPU::fusedPairs[i][0] == op1 && CPU::fusedPairs[i][1] == op2) {
+      return i;
+    }
+  }
+  return 0;
+}
 
-    // SET 5, A
-    case 0xEF:
-      bitSet(reg.a, 5);
-      break;
+// Copy and fill loops, see runBulkLoop(). Index 0 is unused.
+const CPU::bulkLoop CPU::bulkLoops[] = {
+    {},
+    // LDI A, (HL) / LD (DE), A / INC DE / DEC BC / LD A, B / OR C / JR NZ
+    {7, {0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1, 0x20}, BULK_HL, BULK_DE, BULK_BC},
+    // LD A, (DE) / LDI (HL), A / INC DE / DEC BC / LD A, B / OR C / JR NZ
+    {7, {0x1A, 0x22, 0x13, 0x0B, 0x78, 0xB1, 0x20}, BULK_DE, BULK_HL, BULK_BC},
+    // LDI A, (HL) / LD (DE), A / INC DE / DEC B / JR NZ
+    {5, {0x2A, 0x12, 0x13, 0x05, 0x20}, BULK_HL, BULK_DE, BULK_B},
+    // LD A, (DE) / LDI (HL), A / INC DE / DEC B / JR NZ
+    {5, {0x1A, 0x22, 0x13, 0x05, 0x20}, BULK_DE, BULK_HL, BULK_B},
+    // LD A, n / LDI (HL), A / DEC BC / LD A, B / OR C / JR NZ
+    {6, {0x3E, 0x22, 0x0B, 0x78, 0xB1, 0x20}, BULK_OPERAND, BULK_HL, BULK_BC},
+    // LDI (HL), A / DEC B / JR NZ
+    {3, {0x22, 0x05, 0x20}, BULK_A, BULK_HL, BULK_B},
+    // LDI (HL), A / DEC C / JR NZ
+    {3, {0x22, 0x0D, 0x20}, BULK_A, BULK_HL, BULK_C},
+};
+const u32 CPU::bulkLoopCount = sizeof(bulkLoops) / sizeof(bulkLoops[0]);
+
+// bulkLoops index of the count instructions at ops, or 0 if none match
+static u8 bulkIndex(const CPU::decodedOp *ops, u32 count) {
+  for (u32 i = 1; i < CPU::bulkLoopCount; i++) {
+    const CPU::bulkLoop &b = CPU::bulkLoops[i];
+    bool match = b.count == count;
+    for (u32 j = 0; match && j < count; j++) {
+      match = ops[j].op == b.ops[j];
+    }
+    if (match) {
+      return i;
+    }
+  }
+  return 0;
+}
 
-    // SET 6, B
-    case 0xF0:
-      bitSet(reg.b, 6);
+// Decode a block starting at pc onto the end of ops. Instructions must not
+// cross limit, the end of the memory region pc is in. Returns the block's
+// index in ops, or 0 if not even the first instruction fits.
+u32 CPU::decodeBlock(std::vector<decodedOp> &ops, u16 pc, u32 limit) {
+  u32 start = ops.size();
+  u32 addr = pc;
+  for (int i = 0; i < 64 && addr < limit; i++) {
+    decodedOp d = decode(addr);
+    if (addr + d.length > limit) {
       break;
+    }
+    ops.push_back(d);
+    if (ops.size() - start > 1) {
+      decodedOp &prev = ops[ops.size() - 2];
+      prev.fused = fusedIndex(prev.op, d.op);
+    }
+    if (&ops == &ramOps) {
+      mmu.markCode(addr, d.length);
+    }
+    addr += d.length;
 
-    // SET 6, C
-    case 0xF1:
-      bitSet(reg.c, 6);
+    if (endsBlock(d.op)) {
       break;
+    }
+  }
+  if (ops.size() == start) {
+    return 0;
+  }
 
-    // SET 6, D
-    case 0xF2:
-      bitSet(reg.d, 6);
+  // A block that branches back to pc without writing memory is an idle loop
+  // candidate, see runIdleLoop(); one that copies or fills memory may be a
+  // bulk loop, see runBulkLoop(). Either way its branch has to run on its
+  // own.
+  decodedOp &last = ops.back();
+  u32 count = ops.size() - start;
+  bool loop = false;
+  switch (last.op) {
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:  // JR
+      loop = u16(addr + (s8)last.operand) == pc;
       break;
-
-    // SET 6, E
-    case 0xF3:
-      bitSet(reg.e, 6);
+    case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:  // JP
+      loop = last.operand == pc;
       break;
+  }
+  bool idle = loop;
+  for (u32 i = start; idle && i < start + count - 1; i++) {
+    idle = fusable(ops[i].op, 0x00);
+  }
+  if (idle) {
+    last.idle = count;
+  } else if (loop && last.op == 0x20) {
+    last.bulk = bulkIndex(&ops[start], count);
+  }
+  if ((last.idle || last.bulk) && count > 1) {
+    ops[ops.size() - 2].fused = 0;
+  }
 
-    // SET 6, H
-    case 0xF4:
-      bitSet(reg.h, 6);
-      break;
+  decodedOp end = {};
+  ops.push_back(end);
+  return start;
+}
 
-    // SET 6, L
-    case 0xF5:
-      bitSet(reg.l, 6);
-      break;
+// branch closes an idle loop. When it goes back to the top with the same
+// registers and flags as last time, and the budget has gone down by exactly
+// one iteration (no GPU event, interrupt or anything else in between), the
+// loop will keep doing the same until the next scheduled event. Count as
+// many whole iterations as fit in the budget. Nothing else can request an
+// interrupt meanwhile: joypad input arrives between frames. A loop that
+// reads DIV or TIMA sees them change without any event, so isn't skipped.
+bool CPU::runIdleLoop(const decodedOp &branch, int budget) {
+  bool ok = (this->*opcodeTable[branch.op])(branch.operand);
+  u32 cycles = cpu_clock_t;
+  bool polled = mmu.timer->polled;
+  mmu.timer->polled = false;
+
+  int period;
+  if (reg.pc != loopTop(branch, branch.idle, period)) {
+    return ok;
+  }
 
-    // SET 6, (HL)
-    case 0xF6: {
-      u8 val = mmu.read8(reg.hl);
-      bitSet(val, 6);
-      mmu.write8(reg.hl, val);
-    } break;
+  if (budget == idleBudget - period && !polled &&
+      !memcmp(&reg, &idleRegs, sizeof(reg)) &&
+      !memcmp(&lazy, &idleFlags, sizeof(lazy)) &&
+      !(ime && mmu.pending)) {
+    int skipped = std::max(budget - (int)cycles, 0) / period * period;
+    cpu_clock_t += skipped;
+    idleCycles += skipped;
+    budget -= skipped;
+  }
+  idleRegs = reg;
+  idleFlags = lazy;
+  idleBudget = budget;
+  return ok;
+}
 
-    // SET 6, A
-    case 0xF7:
-      bitSet(reg.a, 6);
-      break;
+// branch closes a copy or fill loop. If it went back to the top, the
+// remaining iterations are given by the counter; do as many of them as fit
+// in the budget in one go. The loop can't request an interrupt, and an
+// interrupt already waiting is taken first. MMU::copy() and MMU::fill() refuse anything but
+// plain memory, and memory holding decoded code, in which case the loop
+// carries on one instruction at a time.
+bool CPU::runBulkLoop(const decodedOp &branch, int budget) {
+  bool ok = (this->*opcodeTable[branch.op])(branch.operand);
+  u32 cycles = cpu_clock_t;
+
+  const bulkLoop &b = bulkLoops[branch.bulk];
+  int period;
+  u16 top = loopTop(branch, b.count, period);
+  if (reg.pc != top || (ime && mmu.pending)) {
+    return ok;
+  }
 
-    // SET 7, B
-    case 0xF8:
-      bitSet(reg.b, 7);
-      break;
+  u32 remaining = b.counter == BULK_B ? reg.b
+                  : b.counter == BULK_C ? reg.c
+                                        : reg.bc;
+  u32 n = std::min<u32>(remaining, std::max(budget - (int)cycles, 0) / period);
+  if (n < 2) {
+    return ok;
+  }
+  n--;  // the last one runs as usual
+
+  const decodedOp *first = &branch - (b.count - 1);
+  u16 &dst = b.dst == BULK_HL ? reg.hl : reg.de;
+  if (b.src == BULK_HL || b.src == BULK_DE) {
+    u16 &src = b.src == BULK_HL ? reg.hl : reg.de;
+    if (!mmu.copy(dst, src, n)) {
+      return ok;
+    }
+    src += n;
+  } else {
+    u8 value = b.src == BULK_A ? reg.a : first->operand;
+    if (!mmu.fill(dst, value, n)) {
+      return ok;
+    }
+  }
+  dst += n;
+  if (b.counter == BULK_B) {
+    reg.b -= n;
+  } else if (b.counter == BULK_C) {
+    reg.c -= n;
+  } else {
+    reg.bc -= n;
+  }
+  cycles += n * period;
 
-    // SET 7, C
-    case 0xF9:
-      bitSet(reg.c, 7);
-      break;
+  for (const decodedOp *d = first; d <= &branch; d++) {
+    reg.pc += d->length;
+    cpu_clock_t = d->cycles;
+    ok = (this->*opcodeTable[d->op])(d->operand) && ok;
+    cycles += cpu_clock_t;
+  }
+  cpu_clock_t = cycles;
+  bulkInstructions += (n + 1) * b.count;
+  return ok;
+}
 
-    // SET 7, D
-    case 0xFA:
-      bitSet(reg.d, 7);
-      break;
+u16 CPU::loopTop(const decodedOp &branch, u32 count, int &period) {
+  const decodedOp *first = &branch - (count - 1);
+  u16 top = cursorPC;
+  period = cpu_clock_t - branch.cycles;  // taken branches cost extra
+  for (const decodedOp *d = first; d <= &branch; d++) {
+    top -= d->length;
+    period += d->cycles;
+  }
+  return top;
+}
 
-    // SET 7, E
-    case 0xFB:
-      bitSet(reg.e, 7);
-      break;
+// Find (or decode) the block starting at pc
+const CPU::decodedOp *CPU::lookupBlock(u16 pc) {
+  if (cacheGeneration != mmu.codeGeneration) {
+    flushBlocks(romGeneration != mmu.romCodeGeneration,
+                ramGeneration != mmu.ramCodeGeneration);
+  }
 
-    // SET 7, H
-    case 0xFC:
-      bitSet(reg.h, 7);
-      break;
+  u32 *block = nullptr;
+  std::vector<decodedOp> *ops = nullptr;
+  u32 limit = 0;
+  if (pc <= 0x7FFF) {
+    u32 bank = pc <= 0x3FFF ? 0 : 1 + mmu.mbc.romOffset / 0x4000;
+    if (bank >= romBlocks.size()) {
+      romBlocks.resize(bank + 1);
+    }
+    if (romBlocks[bank].empty()) {
+      romBlocks[bank].assign(0x4000, 0);
+    }
+    block = &romBlocks[bank][pc & 0x3FFF];
+    ops = &romOps;
+    limit = pc <= 0x3FFF ? 0x4000 : 0x8000;
+  } else if ((pc >= 0xC000 && pc <= 0xDFFF) || (pc >= 0xFF80 && pc <= 0xFFFE)) {
+    block = &ramBlocks[pc - 0xC000];
+    ops = &ramOps;
+    limit = pc <= 0xDFFF ? 0xE000 : 0xFFFF;
+  }
 
-    // SET 7, L
-    case 0xFD:
-      bitSet(reg.l, 7);
-      break;
+  if (block) {
+    if (!*block) {
+      *block = decodeBlock(*ops, pc, limit);
+    }
+    if (*block) {
+      return &(*ops)[*block];
+    }
+  }
 
-    // SET 7, (HL)
-    case 0xFE: {
-      u8 val = mmu.read8(reg.hl);
-      bitSet(val, 7);
-      mmu.write8(reg.hl, val);
-    } break;
+  // VRAM, external RAM, echo RAM and I/O, or an instruction that runs off
+  // the end of its region: decode it on its own
+  uncached[0] = decode(pc);
+  return uncached;
+}
 
-    // SET 7, A
-    case 0xFF:
-      bitSet(reg.a, 7);
-      break;
+// Forget decoded blocks. Index 0 of each list is a dummy so that a block
+// index of 0 can mean "not decoded".
+void CPU::flushBlocks(bool rom, bool ram) {
+  decodedOp end = {};
+  if (rom) {
+    romOps.assign(1, end);
+    romBlocks.clear();
+  }
+  if (ram) {
+    ramOps.assign(1, end);
+    ramBlocks.assign(0x4000, 0);
+  }
+  uncached[1] = end;
+  cursor = &uncached[1];
+  cacheGeneration = mmu.codeGeneration;
+  romGeneration = mmu.romCodeGeneration;
+  ramGeneration = mmu.ramCodeGeneration;
+}
 
-    default:
-      return false;
-      break;
+// Extended instruction set via 0xCB prefix
+bool CPU::execute_CB(u8 op) {
+#ifdef GB_COMPUTED_GOTO
+#define GB_LABEL(op) &&cb_##op,
+#define GB_CASE(op)        \
+  cb_##op:                 \
+  if (!opcodeCB<op>()) {   \
+    return false;          \
+  }                        \
+  goto done;
+  static const void *const labels[256] = {GB_OPCODES(GB_LABEL)};
+  goto *labels[op];
+  GB_OPCODES(GB_CASE)
+#undef GB_LABEL
+#undef GB_CASE
+done:
+#else
+  if (!(this->*opcodeTableCB[op])()) {
+    return false;
   }
+#endif
 
-  updateDivider(cpu_clock_t);
-  updateTimer(cpu_clock_t);
   return true;
 }
 
@@ -3192,19 +2108,21 @@ Interrupt request register: 0xFF0F
 Interrupt enable register: 0xFFFF allows disabling/enabling specific registers
 */
 void CPU::checkInterrupts() {
+  u8 pending = mmu.pending;
+  if (!pending) {
+    eiDelay = false;
+    return;
+  }
+  halted = false;  // any requested interrupt ends HALT, even with IME off
   if (!ime || eiDelay) {  // IME disabled or the last instruction was EI
     eiDelay = false;
     return;
   }
-  u8 requested = mmu.read8(IF);
-  if (requested > 0) {
-    u8 enabled = mmu.read8(IE);
-    for (u8 i = 0; i < 5; i++) {
-      if (bitTest(requested, i)) {
-        if (bitTest(enabled, i)) {
-          doInterrupt(i);
-        }
-      }
+  // Take the one with the highest priority, the lowest bit
+  for (u8 i = 0; i < 5; i++) {
+    if (bitTest(pending, i)) {
+      doInterrupt(i);
+      return;
     }
   }
 }
@@ -3216,6 +2134,7 @@ void CPU::doInterrupt(u8 interrupt) {
   u8 flags = mmu.memory[IF];
   bitClear(flags, interrupt);
   mmu.memory[IF] = flags;
+  mmu.updatePending();
 
   reg.sp -= 2;
   mmu.write16(reg.sp, reg.pc);  // Push PC to the stack
@@ -3241,75 +2160,4 @@ void CPU::doInterrupt(u8 interrupt) {
     default:
       break;
   }
-}
-
-// GB-Z80 clock speed / increment rate == 4194304 Hz / 16384 Hz  == 256 cycles
-void CPU::updateDivider(u8 cycles) {
-  timerCounter += cycles;
-  if (timerCounter >= 256) {
-    timerCounter = 0;
-    mmu.memory[DIV] = 0;
-  } else {
-    mmu.memory[DIV]++;
-  }
-}
-
-/*
-FF05 - TIMA - Timer counter (R/W)
-This timer is incremented by a clock frequency specified by the TAC register
-($FF07). When the value overflows (gets bigger than FFh) then it will be reset
-to the value specified in TMA (FF06), and an interrupt will be requested, as
-described below.
-
-FF06 - TMA - Timer Modulo (R/W)
-When the TIMA overflows, this data will be loaded.
-
-FF07 - TAC - Timer Control (R/W)
- Bit  2   - Timer Enable
- Bits 1-0 - Input Clock Select
-            00: CPU Clock / 1024 (DMG, CGB:   4096 Hz, SGB:   ~4194 Hz)
-            01: CPU Clock / 16   (DMG, CGB: 262144 Hz, SGB: ~268400 Hz)
-            10: CPU Clock / 64   (DMG, CGB:  65536 Hz, SGB:  ~67110 Hz)
-            11: CPU Clock / 256  (DMG, CGB:  16384 Hz, SGB:  ~16780 Hz)*/
-void CPU::updateTimer(u8 cycles) {
-  // Return if timer disabled
-  if (!bitTest(mmu.memory[TAC], 2)) {
-    return;
-  }
-
-  // Handle timer input clock selection changes
-  if (timerMode != (mmu.memory[TAC] & 0x3)) {
-    timerMode = mmu.memory[TAC] & 0x3;
-    switch (timerMode) {
-      case 0:
-        timerCycles = 1024;  // clock / inc rate == 4194304÷4096 == 1024 cycles
-        break;
-      case 1:
-        timerCycles = 16;
-        break;
-      case 2:
-        timerCycles = 64;
-        break;
-      case 3:
-        timerCycles = 256;
-        break;
-      default:
-        break;
-    }
-  }
-
-  timerCounter += cycles;
-
-  if (timerCounter >= timerCycles) {
-    timerCounter = 0;
-    // Check for timer overflow
-    if (mmu.memory[TIMA] >= 0xFF) {
-      mmu.memory[TIMA] = 0;
-      // Request interrupt
-      // todo: I think there is a 4 cycle delay here
-      bitSet(mmu.memory[IF], 2);
-    } else {
-      mmu.memory[TIMA]++;
-    }
-  }
 }
\ No newline at end of file
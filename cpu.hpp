@@ -2,7 +2,7 @@
 // File: cpu.hpp
 // Description: CPU implementation
 //
-// GB-Z80 interpreter, timers, interrupt handling
+// GB-Z80 interpreter, interrupt handling
 
 #ifndef GB_CPU
 #define GB_CPU
@@ -13,6 +13,18 @@
 #include "common.hpp"
 #include "mmu.hpp"
 
+// Expands X(op) once for every opcode 0x00-0xFF, in order
+#define GB_OPCODE_ROW(X, hi)                                                 \
+  X(hi##0) X(hi##1) X(hi##2) X(hi##3) X(hi##4) X(hi##5) X(hi##6) X(hi##7)   \
+  X(hi##8) X(hi##9) X(hi##A) X(hi##B) X(hi##C) X(hi##D) X(hi##E) X(hi##F)
+#define GB_OPCODES(X)                                                        \
+  GB_OPCODE_ROW(X, 0x0) GB_OPCODE_ROW(X, 0x1) GB_OPCODE_ROW(X, 0x2)          \
+  GB_OPCODE_ROW(X, 0x3) GB_OPCODE_ROW(X, 0x4) GB_OPCODE_ROW(X, 0x5)          \
+  GB_OPCODE_ROW(X, 0x6) GB_OPCODE_ROW(X, 0x7) GB_OPCODE_ROW(X, 0x8)          \
+  GB_OPCODE_ROW(X, 0x9) GB_OPCODE_ROW(X, 0xA) GB_OPCODE_ROW(X, 0xB)          \
+  GB_OPCODE_ROW(X, 0xC) GB_OPCODE_ROW(X, 0xD) GB_OPCODE_ROW(X, 0xE)          \
+  GB_OPCODE_ROW(X, 0xF)
+
 class CPU {
  public:
   struct registers {
@@ -51,10 +63,29 @@ class CPU {
     u16 pc, sp;
   } reg;
 
+  // Lazy flags: ALU ops record their operands and result here instead of
+  // rebuilding F bit by bit. Readers use flagZ()/flagC(), or syncFlags() when
+  // they need all of F (PUSH AF, DAA, the debugger, ...).
+  // Build with GB_EAGER_FLAGS to compute F after every op instead.
+  enum { FLAGS_SYNCED, FLAGS_ADD, FLAGS_SUB, FLAGS_INC, FLAGS_DEC, FLAGS_AND,
+         FLAGS_OR };
+  struct lazyFlags {
+    u8 op;  // FLAGS_SYNCED when reg.f is up to date
+    u8 lhs, rhs, result;
+    bool carry;
+  } lazy;
+
+  void deferFlags(u8 op, u8 lhs, u8 rhs, u8 result, bool carry);
+  bool flagZ();
+  bool flagC();
+  void clearFlags();
+  void syncFlags();
+
   u32 cpu_clock_t; // CPU cycles; the GB-Z80 runs at 4194304 Hz
 
   bool ime;      // Interrupt master enable,
   bool eiDelay;  // Flag for delaying interrupt after EI instruction
+  bool halted;   // HALT: no instructions run until an interrupt is requested
 
   MMU mmu;
 
@@ -143,17 +174,183 @@ class CPU {
   template <typename t>
   void addCarry(t n);
 
-  bool execute();
+  // Operand r encoded in an opcode's bit fields (B, C, D, E, H, L, (HL), A)
+  template <u8 r>
+  u8 &regR();
+  template <u8 r>
+  u8 readR();
+  template <u8 r>
+  void writeR(u8 value);
+  template <u8 r, typename F>
+  void modifyR(F f);
+
+  // ALU operation n (ADD, ADC, SUB, SBC, AND, XOR, OR, CP) on A and value
+  template <u8 n>
+  void alu(u8 value);
+
+  // Rotate or shift n (RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL) of value
+  template <u8 n>
+  void rotateShift(u8 &value);
+
+  // budget is the number of cycles until the next scheduled event (see
+  // Scheduler). Superinstructions only run while their first instruction
+  // ends inside it; with the default of 0 exactly one instruction runs.
+  // While halted, execute() skips the whole budget.
+  bool execute(int budget = 0);
   bool execute_CB(u8 op);  // execute extended instruction set
 
-  void checkInterrupts();
-  void doInterrupt(u8 interrupt);
+  // Block cache: runs of instructions decoded once, up to the first jump,
+  // call or return, so execute() doesn't fetch and decode every time.
+  // Blocks are kept for ROM (per bank), WRAM and HRAM; other code is decoded
+  // one instruction at a time. See MMU::codeGeneration for invalidation.
+  struct decodedOp {
+    u16 operand;
+    u8 op;
+    u8 length;  // 0 marks the end of a block
+    u8 cycles;
+    u8 fused;  // fusedTable index if this and the next op are a pair, or 0
+    u8 idle;   // instructions in the idle loop this branch closes, or 0
+    u8 bulk;   // bulkLoops index of the copy or fill loop it closes, or 0
+  };
+  std::vector<decodedOp> romOps, ramOps;    // decoded blocks, back to back
+  std::vector<std::vector<u32>> romBlocks;  // [0: fixed, 1 + bank][pc & 0x3FFF]
+  std::vector<u32> ramBlocks;               // [pc - 0xC000]
+  decodedOp uncached[2];
+  const decodedOp *cursor;  // next decoded instruction, valid at cursorPC
+  u16 cursorPC;
+  u32 cacheGeneration, romGeneration, ramGeneration;
+
+  const decodedOp *lookupBlock(u16 pc);
+  u32 decodeBlock(std::vector<decodedOp> &ops, u16 pc, u32 limit);
+  decodedOp decode(u16 pc);
+  void flushBlocks(bool rom, bool ram);
+
+  // Instructions that can change PC end a block
+  static constexpr bool endsBlock(u8 op) {
+    switch (op) {
+      case 0x10:  // STOP
+      case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:  // JR
+      case 0x76:  // HALT
+      case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9:  // JP
+      case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:  // CALL
+      case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9:  // RET
+      case 0xC7: case 0xCF: case 0xD7: case 0xDF:  // RST
+      case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Superinstructions: pairs of instructions run by one handler, listed in
+  // superinstructions.hpp. The first of a pair must not write memory, end a
+  // block or change IME, so nothing that happens between two
+  // instructions (interrupts, GPU steps) could have seen it. The second can
+  // be anything but HALT, STOP or an undefined opcode.
+  static constexpr bool fusable(u8 op1, u8 op2) {
+    switch (op1) {
+      case 0x02: case 0x08: case 0x12: case 0x22: case 0x32:  // stores
+      case 0x34: case 0x35: case 0x36: case 0x70: case 0x71: case 0x72:
+      case 0x73: case 0x74: case 0x75: case 0x77: case 0xE0: case 0xE2:
+      case 0xEA:
+      case 0xC5: case 0xD5: case 0xE5: case 0xF5:  // PUSH
+      case 0xCB:  // (HL) forms write memory
+      case 0xF3: case 0xFB:  // DI, EI
+        return false;
+    }
+    switch (op2) {
+      case 0x10: case 0x76:
+        return false;
+    }
+    for (u8 op : {op1, op2}) {
+      switch (op) {
+        case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB:
+        case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+          return false;
+      }
+    }
+    return !endsBlock(op1);
+  }
+
+  // Opcode handlers (see cpu.cpp). Register blocks are generated from the
+  // opcode's bit fields, the rest are specialized. They return false if the
+  // instruction could not be executed.
+  template <u8 op>
+  bool opcode(u16 operand);
+  template <u8 op>
+  bool opcodeCB();
+
+  // Dispatch tables, indexed by opcode
+  typedef bool (CPU::*Handler)(u16 operand);
+  typedef bool (CPU::*HandlerCB)();
+  static const Handler opcodeTable[256];
+  static const HandlerCB opcodeTableCB[256];
+
+  // Superinstruction handlers, indexed by decodedOp::fused (0 is unused)
+  template <u8 op1, u8 op2>
+  bool fused(u16 operand, const decodedOp &next);
+  typedef bool (CPU::*FusedHandler)(u16 operand, const decodedOp &next);
+  static const FusedHandler fusedTable[];
+  static const u8 fusedPairs[][2];
+  static const u32 fusedCount;
+  u64 superinstructions;  // pairs run by fused handlers
+  bool fuse;              // on/off
+
+  // Whether each memory access op makes with the registers as they are now
+  // passes readable(addr) or writable(addr); see fused() and jitStep()
+  template <u8 op, typename Readable, typename Writable>
+  bool accessesPass(u32 operand, Readable readable, Writable writable) const;
+
+  // Idle loops: a block that branches back to its own start and only reads
+  // memory, e.g. LDH A, (0x44) / CP n / JR NZ waiting for a scanline. Once
+  // an iteration leaves every register as it found it, nothing changes
+  // until the GPU's next event, so execute() skips whole iterations up to
+  // it.
+  bool idleSkip;   // on/off
+  u64 idleCycles;  // cycles skipped
+  registers idleRegs;  // state at the last idle loop branch
+  lazyFlags idleFlags;
+  int idleBudget;
+  bool runIdleLoop(const decodedOp &branch, int budget);
+
+  // Copy and fill loops: blocks matching one of bulkLoops, e.g.
+  // LDI A, (HL) / LD (DE), A / INC DE / DEC BC / LD A, B / OR C / JR NZ.
+  // Once the branch goes back to the top, execute() does all but the last
+  // of the remaining iterations (as many as fit in the budget) with one
+  // MMU::copy() or MMU::fill() and runs the last one as usual, which leaves
+  // A and the flags as the loop would have.
+  enum { BULK_HL, BULK_DE, BULK_A, BULK_OPERAND };  // sources and destinations
+  enum { BULK_B, BULK_C, BULK_BC };                 // counters
+  struct bulkLoop {
+    u8 count;  // instructions, the last a JR NZ back to the first
+    u8 ops[7];
+    u8 src, dst;  // pointers are incremented once per iteration
+    u8 counter;   // decremented once per iteration
+  };
+  static const bulkLoop bulkLoops[];
+  static const u32 bulkLoopCount;
+  bool bulkCopy;          // on/off
+  u64 bulkInstructions;   // instructions stood in for by copies and fills
+  bool runBulkLoop(const decodedOp &branch, int budget);
+
+  // Start and cycles per iteration of the loop closed by branch, which has
+  // just run; count is the number of instructions in the loop
+  u16 loopTop(const decodedOp &branch, u32 count, int &period);
+
+#ifdef GB_PROFILE_PAIRS
+  // How often each opcode ran straight after another, [op1 << 8 | op2]
+  std::vector<u64> pairCounts;
+  u8 lastOp;
+#endif
 
-  int dividerCounter;
-  void updateDivider(u8 cycles);
+  // Single instruction entry points called from JIT compiled code
+  template <u8 op>
+  static u32 jitStep(CPU *cpu, u32 operand, u32 pc, u32 *budget);
+  typedef u32 (*JitStep)(CPU *cpu, u32 operand, u32 pc, u32 *budget);
+  static const JitStep jitSteps[256];
 
-  int timerMode, timerCycles, timerCounter;
-  void updateTimer(u8 cycles);
+  void checkInterrupts();
+  void doInterrupt(u8 interrupt);
 
   struct instruction {  // thx to cinoop
     char const *disassembly;
@@ -0,0 +1,64 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: flags.hpp
+// Description: CPU flag bits and precomputed flag tables
+//
+// F for the 8-bit ADD/ADC/SUB/SBC/CP/INC/DEC ops is built at compile time, so
+// the ALU gets it with one indexed load instead of a chain of branches.
+
+#ifndef GB_FLAGS
+#define GB_FLAGS
+
+#include "common.hpp"
+
+// Set if a carry occurred from the last arithmetic operation or if
+// register A is the smaller value when executing the CP instruction
+#define FLAG_CARRY 4
+
+// Set if a carry occurred from the lower nibble in the last math operation.
+#define FLAG_HALF_CARRY 5
+
+// Set if a subtraction was performed in the last math instruction.
+#define FLAG_SUBTRACT 6
+
+// Set when the result of an arithmetic operation is zero or two values match when using CP
+#define FLAG_ZERO 7
+
+struct flagTables {
+  u8 add[2][256][256];  // [carry in][a][n]: ADD (carry 0) and ADC
+  u8 sub[2][256][256];  // [carry in][a][n]: SUB/CP (carry 0) and SBC
+  u8 inc[256];          // [result], carry not included
+  u8 dec[256];          // [result], carry not included
+};
+
+constexpr flagTables makeFlagTables() {
+  flagTables t{};
+  for (int c = 0; c < 2; c++) {
+    for (int a = 0; a < 256; a++) {
+      for (int n = 0; n < 256; n++) {
+        u8 f = 0;
+        if (((a + n + c) & 0xFF) == 0) f |= 1 << FLAG_ZERO;
+        if ((a & 0xF) + (n & 0xF) + c > 0xF) f |= 1 << FLAG_HALF_CARRY;
+        if (a + n + c > 0xFF) f |= 1 << FLAG_CARRY;
+        t.add[c][a][n] = f;
+
+        // SBC compares against n + carry, including in the low nibble
+        f = 1 << FLAG_SUBTRACT;
+        if (((a - n - c) & 0xFF) == 0) f |= 1 << FLAG_ZERO;
+        if ((a & 0xF) < ((n + c) & 0xF)) f |= 1 << FLAG_HALF_CARRY;
+        if (a < n + c) f |= 1 << FLAG_CARRY;
+        t.sub[c][a][n] = f;
+      }
+    }
+  }
+  for (int r = 0; r < 256; r++) {
+    t.inc[r] = (r == 0 ? 1 << FLAG_ZERO : 0) |
+               ((r & 0xF) == 0 ? 1 << FLAG_HALF_CARRY : 0);
+    t.dec[r] = (1 << FLAG_SUBTRACT) | (r == 0 ? 1 << FLAG_ZERO : 0) |
+               ((r & 0xF) == 0xF ? 1 << FLAG_HALF_CARRY : 0);
+  }
+  return t;
+}
+
+constexpr flagTables FLAG_TABLES = makeFlagTables();
+
+#endif
@@ -0,0 +1,82 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: gameboy.cpp
+// Description: Emulator core
+
+#include <algorithm>
+#include "accuracy.hpp"
+#include "gameboy.hpp"
+
+const u64 FRAME_CYCLES = 70224;  // 154 scanlines of 456 cycles
+
+Gameboy::Gameboy() : jit(&cpu) {
+  gpu.mmu = &cpu.mmu;
+  gpu.scheduler = &scheduler;
+  cpu.mmu.joypad = &joypad;
+  cpu.mmu.gpu = &gpu;
+  timer.mmu = &cpu.mmu;
+  timer.scheduler = &scheduler;
+  cpu.mmu.timer = &timer;
+  cpu.mmu.scheduler = &scheduler;
+  gpu.reset();
+  timer.reset();
+  interpreted = 0;
+}
+
+bool Gameboy::load(char *filename, const char *saveFilename) {
+  return cpu.mmu.load(filename, saveFilename);
+}
+
+void Gameboy::runCycles(u64 cycles) {
+  u64 until = scheduler.now + cycles;
+  while (scheduler.now < until) {
+    run(until);
+  }
+}
+
+bool Gameboy::runUntilVSync() {
+  u64 until = scheduler.now + FRAME_CYCLES;
+  while (!gpu.vsync && scheduler.now < until) {
+    run(until);
+  }
+  cpu.mmu.syncRAM();
+  bool vsync = gpu.vsync;
+  gpu.vsync = false;
+  return vsync;
+}
+
+void Gameboy::step() { run(scheduler.now); }
+
+// Run the CPU up to the next event or until, whichever comes first, or until
+// it writes an I/O register. Then bring the GPU up to date and handle the
+// events that are due. Always runs at least one instruction. With the LCD
+// and timer off there may be no event at all; the CPU then runs up to until,
+// a frame at most so the budget fits in an int.
+void Gameboy::run(u64 until) {
+  u64 deadline =
+      std::min({scheduler.next(), until, scheduler.now + FRAME_CYCLES});
+  cpu.mmu.ioWritten = false;
+  do {
+    cpu.checkInterrupts();
+    int budget = deadline - scheduler.now;
+    u32 cycles = jit.enabled ? jit.run(budget) : 0;
+    if (!cycles) {
+      interpreted += !cpu.halted;
+      cpu.execute(budget);
+      cycles = cpu.cpu_clock_t;
+      if constexpr (Accuracy::memoryTiming) {
+        cpu.mmu.accessOffset = 0;
+      }
+    }
+    scheduler.now += cycles;
+  } while (scheduler.now < deadline && !cpu.mmu.ioWritten);
+  gpu.sync();
+
+  Scheduler::event event;
+  while (scheduler.pop(event)) {
+    if (event == Scheduler::TIMER) {
+      timer.overflow();
+    } else if (event == Scheduler::DMA) {
+      cpu.mmu.endDMA();
+    }
+  }
+}
@@ -0,0 +1,50 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: gameboy.hpp
+// Description: Emulator core
+//
+// Wires the CPU, GPU, timer, joypad and JIT to each other and the scheduler,
+// and runs them. Frontends (main.cpp, bench.cpp) only need this.
+
+#ifndef GB_GAMEBOY
+#define GB_GAMEBOY
+
+#include "common.hpp"
+#include "cpu.hpp"
+#include "gpu.hpp"
+#include "jit.hpp"
+#include "joypad.hpp"
+#include "scheduler.hpp"
+#include "timer.hpp"
+
+class Gameboy {
+ public:
+  Gameboy();
+
+  // Load a ROM file; see MMU::load()
+  bool load(char *filename, const char *saveFilename = nullptr);
+
+  // Run for at least cycles T-cycles; the last instruction can go past
+  void runCycles(u64 cycles);
+
+  // Run until the GPU enters vblank, or for a frame's worth of cycles if it
+  // doesn't (the LCD is off), then start saving cartridge RAM. Returns true
+  // on vblank.
+  bool runUntilVSync();
+
+  // Run one instruction, for debuggers: nothing is run past a breakpoint
+  void step();
+
+  CPU cpu;
+  GPU gpu;
+  Joypad joypad;
+  Scheduler scheduler;
+  Timer timer;
+  JIT jit;
+
+  u64 interpreted;  // instructions run by CPU::execute(), not counting HALT
+
+ private:
+  void run(u64 until);
+};
+
+#endif
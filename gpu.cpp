@@ -4,6 +4,7 @@
 //
 // Graphics are rendered using the Simple DirectMedia Layer library (SDL 2.0)
 
+#include <algorithm>
 #include "gpu.hpp"
 
 GPU::GPU() {}
@@ -14,119 +15,219 @@ void GPU::reset() {
   width = 160;
   height = 144;
   scanline = 0;
-  mmu->memory[LY] = scanline;
-  mmu->memory[STAT] = 0x84;
-  modeclock = 0;
+  mode = 2;
+  drawCycles = 172;
+  drawnX = 0;
+  mmu->memory[STAT] = 0;
   memset(screenData, 0xFF, sizeof(screenData));
   vsync = false;
+  if (bitTest(mmu->memory[LCDC], LCDC_DISPLAY_ENABLE)) {
+    nextAt = scheduler->now + 80;
+    scheduler->schedule(Scheduler::PPU, nextAt);
+  } else {
+    nextAt = Scheduler::NEVER;
+    scheduler->cancel(Scheduler::PPU);
+  }
 }
 
-/*
-144 visible scanlines, 8 invisible.
-Scanlines are drawn one at a time from 0 to 153.
-Between 144 and 153 is the vblank period.
-It takes 456 cpu cycles to draw one scanline and move on to the next.
+u64 GPU::clock() {
+  if constexpr (Accuracy::memoryTiming) {
+    return scheduler->now + mmu->accessOffset;
+  }
+  return scheduler->now;
+}
 
-*/
-void GPU::step(u8 cycles) {
-  u8 status = mmu->memory[STAT];
+void GPU::sync() {
+  u64 now = clock();
+  while (nextAt <= now) {
+    step();
+  }
+}
 
-  // If the LCD is disabled:
-  if (!(bitTest(mmu->memory[LCDC], LCDC_DISPLAY_ENABLE))) {
-    modeclock = 0;
+u8 GPU::read(u16 addr) {
+  sync();
+  if (addr == LY) {
+    return scanline;
+  }
+  u8 status = 0x80 | mmu->memory[STAT] | mode;
+  if (scanline == mmu->memory[LYC]) {
+    bitSet(status, STAT_LYC_FLAG);
+  }
+  return status;
+}
+
+void GPU::write(u16 addr, u8 value) {
+  sync();
+  if (addr != STAT && addr != LY && addr != LYC) {
+    catchUp();
+  }
+  bool enabled = bitTest(mmu->memory[LCDC], LCDC_DISPLAY_ENABLE);
+  bool lyc = lycInterrupt();
+  switch (addr) {
+    case STAT:
+      mmu->memory[STAT] = value & 0x78;  // the mode and LYC flag are read only
+      break;
+    case LY:
+      break;  // read only
+    default:
+      mmu->memory[addr] = value;
+      break;
+  }
+
+  if (bitTest(mmu->memory[LCDC], LCDC_DISPLAY_ENABLE) == enabled) {
+    if (!lyc && lycInterrupt()) {
+      requestInterrupt(1);
+    }
+  } else if (enabled) {
+    // LCD off: line 0 in mode 2 until it's back on. Nothing happens in the
+    // meantime, so there's no PPU event until this write turns it back on.
+    // todo: hack to match BGB LCD timings
     scanline = 0;
-    mode = 2;               // todo: hack to match BGB LCD timings
-    status &= (0xFF << 2);  // clear mode bits in LCD status register
-    status |= mode;
-    mmu->memory[STAT] = status;
-    mmu->memory[LY] = scanline;  // writes to this address are trapped in MMU
-    return;
+    mode = 2;
+    nextAt = Scheduler::NEVER;
+    scheduler->cancel(Scheduler::PPU);
+  } else {
+    // LCD on: line 0 starts now
+    nextAt = clock() + 80;
+    if (lycInterrupt()) {
+      requestInterrupt(1);
+    }
+    scheduler->schedule(Scheduler::PPU, nextAt);
   }
+}
 
-  modeclock += cycles;
-  bool interrupt = false;
+/*
+144 visible scanlines, 10 invisible.
+Scanlines are drawn one at a time from 0 to 153.
+Between 144 and 153 is the vblank period.
+It takes 456 cpu cycles to draw one scanline and move on to the next.
 
+Visible scanlines go through OAM read (mode 2, 80 cycles), VRAM read (mode 3,
+172 cycles) and hblank (mode 0, 204 cycles). The scanline is drawn at the end
+of mode 3.
+*/
+void GPU::step() {
   switch (mode) {
-    // OAM read mode, 80 cycles
     case 2:
-      if (modeclock >= 80) {
-        modeclock = 0;
-        mode = 3;
-      }
+      mode = 3;
+      drawnX = 0;
+      drawCycles = transferLength();
+      nextAt += drawCycles;
       break;
 
-    // VRAM read mode, 172 cycles. End of mode 3 is end of scanline
     case 3:
-      if (modeclock >= 172) {
-        modeclock = 0;
-        mode = 0;  // hblank
-        interrupt = bitTest(mmu->memory[STAT], STAT_MODE0_INT_ENABLE);
-        renderScanline();
-      }
+      mode = 0;  // hblank
+      renderScanline(160);
+      statInterrupt(STAT_MODE0_INT_ENABLE);
+      nextAt += 376 - drawCycles;
       break;
 
-    // hblank, 204 cycles
-    case 0:
-      if (modeclock >= 204) {
-        modeclock = 0;
-        scanline++;
-        if (scanline == 143) {
-          interrupt = bitTest(mmu->memory[STAT], STAT_MODE1_INT_ENABLE);
-          mode = 1;  // vblank
-          renderScreen();
-        } else {
-          mode = 2;
-          interrupt = bitTest(mmu->memory[STAT], STAT_MODE2_INT_ENABLE);
-        }
-      }
+    // End of hblank or of a vblank scanline
+    default:
+      scanline = scanline == 153 ? 0 : scanline + 1;
+      startLine();
       break;
+  }
+  scheduler->schedule(Scheduler::PPU, nextAt);
+}
 
-    // vblank, 456 cycles (10 scanlines)
-    case 1:
-      if (scanline == 144) {
-        requestInterrupt(0);
-      }
-      if (modeclock >= 456) {
-        modeclock = 0;
-        scanline++;
-        if (scanline > 153) {
-          mode = 2;  // restart scanning mode
-          interrupt = bitTest(mmu->memory[STAT], STAT_MODE2_INT_ENABLE);
-          scanline = 0;
-        }
+/*
+Mode 3 takes 172 cycles at least. The pixel FIFO stalls while it throws away
+the first SCX % 8 pixels, for 6 cycles while it restarts on the window, and
+for each sprite on the line while it fetches the sprite: 6 cycles, plus up to
+5 more waiting for the background fetch the sprite lands in to finish. Only
+the first 10 sprites on a line are drawn.
+*/
+u32 GPU::transferLength() {
+  if constexpr (!Accuracy::fifoTiming) {
+    return 172;
+  }
+  u8 control = mmu->memory[LCDC];
+  u8 scx = mmu->memory[SCX];
+  u32 cycles = 172 + (scx & 7);
+  if (bitTest(control, LCDC_WINDOW_ENABLE) && scanline >= mmu->memory[WY] &&
+      mmu->memory[WX] < 167) {
+    cycles += 6;
+  }
+  if (bitTest(control, LCDC_OBJ_ENABLE)) {
+    u8 ySize = bitTest(control, LCDC_OBJ_SIZE) ? 16 : 8;
+    u8 sprites = 0;
+    for (u16 index = 0; index < 160 && sprites < 10; index += 4) {
+      u8 yPos = mmu->memory[OAM_ATTRIB + index] - 16;
+      if ((u8)(scanline - yPos) >= ySize) {
+        continue;
       }
-      break;
+      u8 xPos = mmu->memory[OAM_ATTRIB + index + 1];
+      cycles += 6 + 5 - std::min(5, (xPos + scx) & 7);
+      sprites++;
+    }
   }
+  return cycles;
+}
 
-  if (interrupt) {
+// Enter scanline, which starts at nextAt
+void GPU::startLine() {
+  if (scanline < 144) {
+    mode = 2;
+    statInterrupt(STAT_MODE2_INT_ENABLE);
+    nextAt += 80;
+  } else {
+    if (scanline == 144) {
+      mode = 1;  // vblank
+      requestInterrupt(0);
+      statInterrupt(STAT_MODE1_INT_ENABLE);
+      renderScreen();
+    }
+    nextAt += 456;
+  }
+  if (lycInterrupt()) {
     requestInterrupt(1);
   }
+}
 
-  // Handle coincidence flag and check for interrupt enabled
-  if (scanline == mmu->memory[LYC]) {
-    bitSet(status, STAT_LYC_FLAG);
-    if (bitTest(status, STAT_LYC_INT_ENABLE)) {
-      requestInterrupt(1);
-    }
-  } else {
-    bitClear(status, STAT_LYC_FLAG);
+// The LYC interrupt is requested when this becomes true: at the start of
+// line LYC, or on writes to LYC, STAT or LCDC that make it so
+bool GPU::lycInterrupt() {
+  return bitTest(mmu->memory[LCDC], LCDC_DISPLAY_ENABLE) &&
+         scanline == mmu->memory[LYC] &&
+         bitTest(mmu->memory[STAT], STAT_LYC_INT_ENABLE);
+}
+
+void GPU::statInterrupt(u8 enable) {
+  if (bitTest(mmu->memory[STAT], enable)) {
+    requestInterrupt(1);
   }
+}
 
-  status &= (0xFF << 2);  // clear the mode flag bits
-  status |= mode;
-  mmu->memory[STAT] = status;
-  mmu->memory[LY] = scanline;  // writes to this address are trapped in mmu
+/*
+Pixels come out of mode 3 one per cycle, in its last 160 cycles. Rather than
+emulate them a dot at a time, the line is drawn in one go at the end of mode 3
+unless a register it depends on is written first: then the pixels output so
+far are drawn with the old value, and the rest of the line with the new one.
+*/
+void GPU::catchUp() {
+  if (mode != 3) {
+    return;
+  }
+  u64 left = nextAt - clock();  // cycles to the end of mode 3
+  if (left < 160) {
+    renderScanline(160 - left);
+  }
 }
 
-// Write scanline to framebuffer
-void GPU::renderScanline() {
+// Write the current scanline's pixels from drawnX up to end to framebuffer
+void GPU::renderScanline(int end) {
+  if (end <= drawnX) {
+    return;
+  }
   u8 control = mmu->memory[LCDC];
   if (bitTest(control, LCDC_BG_ENABLE)) {
-    renderBackground();
+    renderBackground(drawnX, end);
   }
   if (bitTest(control, LCDC_OBJ_ENABLE)) {
-    renderSprites();
+    renderSprites(drawnX, end);
   }
+  drawnX = end;
 }
 
 /* Background is 256x256 pixels or 32x32 tiles, of which only 160x144 pixels are
@@ -147,18 +248,18 @@ void GPU::renderScanline() {
 
   Each tile is 8x8 pixels or 16 bytes.
 */
-void GPU::renderBackground() {
+void GPU::renderBackground(int start, int end) {
   u16 tileData = mmu->memory[LCDC] & (1 << 4) ? 0x8000 : 0x8800;
   u16 bgTileMap = mmu->memory[LCDC] & (1 << 3) ? 0x9C00 : 0x9800;
 
   // yPos calculates which of 32 vertical tiles the current scanline is drawing
-  u8 yPos = mmu->memory[SCY] + mmu->memory[LY];
+  u8 yPos = mmu->memory[SCY] + scanline;
 
   // Determine which of the 8 vertical pixels of the current tile the scanline
   // is on
   u16 tileRow = (((u8)(yPos / 8)) * 32);
 
-  for (int pixel = 0; pixel < 160; pixel++) {
+  for (int pixel = start; pixel < end; pixel++) {
     u8 xPos = pixel + mmu->memory[SCX];
 
     // Determine which of the 32 horizontal tiles this xPos falls within
@@ -269,7 +370,7 @@ bit 4: palette number
 bit 3-0: unused for DMG
 */
 u8 prevXpos = 0;
-void GPU::renderSprites() {
+void GPU::renderSprites(int start, int end) {
   u8 ySize = bitTest(mmu->memory[LCDC], LCDC_OBJ_SIZE) ? 16 : 8;
   for (u8 sprite = 0; sprite < 40; sprite++) {
     u8 index = sprite * 4;  // each oam attribute entry is 4 bytes
@@ -300,6 +401,12 @@ void GPU::renderSprites() {
       u8 data2 = mmu->memory[tileData + 1];
 
       for (int tilePixel = 7; tilePixel >= 0; tilePixel--) {
+        u8 pixel = xPos - tilePixel;
+        pixel += 7;
+        if (pixel < start || pixel >= end) {
+          continue;
+        }
+
         int colorBit = tilePixel;
         if (xFlip) {
           colorBit -= 7;
@@ -343,9 +450,6 @@ void GPU::renderSprites() {
             break;  // -Wswitch warning prevention
         }
 
-        u8 pixel = xPos - tilePixel;
-        pixel += 7;
-
         screenData[scanline][pixel][0] = red;
         screenData[scanline][pixel][1] = green;
         screenData[scanline][pixel][2] = blue;
@@ -403,11 +507,7 @@ GPU::COLOR GPU::paletteLookup(u8 colorID, u16 address) {
   return result;
 }
 
-void GPU::requestInterrupt(u8 interrupt) {
-  u8 cpuInterrupts = mmu->memory[IF];
-  bitSet(cpuInterrupts, interrupt);
-  mmu->write8(IF, cpuInterrupts);
-}
+void GPU::requestInterrupt(u8 interrupt) { mmu->requestInterrupt(interrupt); }
 
 void GPU::renderScreen() {
   vsync = true;  // Flag for main loop
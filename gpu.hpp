@@ -9,8 +9,10 @@
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
+#include "accuracy.hpp"
 #include "common.hpp"
 #include "mmu.hpp"
+#include "scheduler.hpp"
 
 #include "imgui/imgui.h"
 
@@ -20,12 +22,22 @@ class GPU {
   ~GPU();
 
   void reset();
-  void step(u8 cycles);  // clock step
+
+  // Run the mode changes due by clock(). Nothing happens in between,
+  // so each one schedules the PPU event for the next.
+  void sync();
+
+  // STAT and LY reads and writes to the LCD registers from the MMU. STAT and
+  // LY aren't kept in memory; they are worked out from the current mode.
+  // Writes during mode 3 draw the pixels output so far first.
+  u8 read(u16 addr);
+  void write(u16 addr, u8 value);
 
   MMU* mmu;
-  int modeclock;
+  Scheduler* scheduler;
   int mode;
   u8 scanline;
+  u64 nextAt;  // cycle of the next mode change
 
   int width;
   int height;
@@ -35,9 +47,20 @@ class GPU {
   u8 screenData[144][160][3];
 
  private:
-  void renderScanline();  // write scanline to surface
-  void renderBackground();
-  void renderSprites();
+  u64 clock();  // cycle of the access being made, see MMU::accessOffset
+  u32 drawCycles;  // length of this line's mode 3
+  u32 transferLength();
+
+  void step();
+  void startLine();
+  bool lycInterrupt();
+  void statInterrupt(u8 enable);
+
+  int drawnX;  // pixels of the current line already written to screenData
+  void catchUp();
+  void renderScanline(int end);  // write scanline to surface
+  void renderBackground(int start, int end);
+  void renderSprites(int start, int end);
   void renderScreen();
 
   enum COLOR { WHITE, LIGHT_GRAY, DARK_GRAY, BLACK };
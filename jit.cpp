@@ -0,0 +1,460 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: jit.cpp
+// Description: x86-64 dynamic recompiler
+//
+// Blocks are compiled from the same decoded instructions the interpreter
+// uses. Register loads, moves, 16-bit INC/DEC and jumps become native code;
+// everything else is a call to CPU::jitStep<op>, which runs the interpreter's
+// handler. After every instruction the cycle count is checked against the
+// budget, so the GPU sees mode changes at exactly the same instruction as it
+// does when stepped after each execute().
+//
+// Compiled code only runs from ROM. It leaves to the interpreter on writes to
+// MBC registers, I/O or IE (see jitWritable) and on EI, DI, RETI, HALT, STOP
+// and unknown opcodes, so banks, interrupts and self-modifying code never
+// change underneath it.
+//
+// Registers while compiled code runs: rbx = CPU, r12d = cycles run since
+// enter(), r13 = &st.
+//
+// The code buffer is never writable and executable at once, which hardened
+// kernels and SELinux refuse: it's read/write while code is emitted or
+// patched and read/execute while it runs. Once everything that runs is
+// compiled and chained, it stays executable.
+
+#include <cstddef>
+#include <cstring>
+#include "jit.hpp"
+
+#ifdef GB_JIT_X64
+#include <sys/mman.h>
+#endif
+
+static_assert(offsetof(JIT::state, budget) == 0x00, "compiled code layout");
+static_assert(offsetof(JIT::state, exit) == 0x04, "compiled code layout");
+static_assert(offsetof(JIT::state, patch) == 0x08, "compiled code layout");
+static_assert(offsetof(JIT::state, instructions) == 0x10,
+              "compiled code layout");
+
+const u32 BUFFER_SIZE = 16 * 1024 * 1024;
+const u32 MAX_BLOCK_INSTRUCTIONS = 64;
+const u32 MAX_BLOCK_BYTES = MAX_BLOCK_INSTRUCTIONS * 128;
+
+u8 *const JIT::FAILED = reinterpret_cast<u8 *>(1);
+
+enum { STUB_BUDGET, STUB_GUARD, STUB_CHAIN };
+
+JIT::JIT(CPU *cpu) : cpu(cpu) {
+  enabled = false;
+  instructions = 0;
+  buffer = nullptr;
+  writable = false;
+  flushes = 0;
+#ifdef GB_JIT_X64
+  void *mem = mmap(nullptr, BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    return;
+  }
+  buffer = (u8 *)mem;
+  writable = true;
+  enabled = true;
+  flush();
+#endif
+}
+
+JIT::~JIT() {
+#ifdef GB_JIT_X64
+  if (buffer) {
+    munmap(buffer, BUFFER_SIZE);
+  }
+#endif
+}
+
+// Instructions that have to go through CPU::execute()
+static bool compilable(u8 op) {
+  switch (op) {
+    case 0x10:  // STOP
+    case 0x76:  // HALT
+    case 0xD9:  // RETI
+    case 0xF3:  // DI
+    case 0xFB:  // EI
+    case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB:
+    case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+      return false;
+    default:
+      return true;
+  }
+}
+
+u32 JIT::run(int budget) {
+#ifdef GB_JIT_X64
+  if (!enabled || budget <= 0 || cpu->debugToFile || cpu->halted) {
+    return 0;
+  }
+
+  // checkInterrupts() is due before the next instruction. Compiled code
+  // doesn't go through read8() and write8(), which lock out OAM DMA.
+  MMU &mmu = cpu->mmu;
+  if ((cpu->ime && mmu.pending) || mmu.dmaActive) {
+    return 0;
+  }
+
+  if (romGeneration != mmu.romCodeGeneration && !flush()) {
+    return 0;
+  }
+
+  u32 cycles = 0;
+  u8 *patch = nullptr;
+  u32 patchFlushes = 0;
+  while (cycles < (u32)budget && cpu->reg.pc <= 0x7FFF) {
+    u16 pc = cpu->reg.pc;
+    u8 *b = block(pc);
+    if (!b) {
+      if (!protect(true)) {
+        break;
+      }
+      b = compile(pc);
+      block(pc) = b ? b : FAILED;
+    }
+    if (!b || b == FAILED) {
+      break;
+    }
+
+    // Point the jump that just exited straight at this block
+    if (patch && patchFlushes == flushes) {
+      if (!protect(true)) {
+        break;
+      }
+      s32 rel = b - (patch + 4);
+      memcpy(patch, &rel, 4);
+    }
+    patch = nullptr;
+
+    if (!protect(false)) {
+      break;
+    }
+    st.budget = budget - cycles;
+    st.instructions = 0;
+    cycles += enter(cpu, b, &st);
+    instructions += st.instructions;
+
+    if (st.exit == EXIT_CHAIN) {
+      patch = st.patch;
+      patchFlushes = flushes;
+    } else if (st.exit != EXIT_LOOKUP) {
+      break;
+    }
+  }
+  return cycles;
+#else
+  return 0;
+#endif
+}
+
+// Compiled block for pc, indexed the same way as the interpreter's blocks
+u8 *&JIT::block(u16 pc) {
+  u32 bank = pc <= 0x3FFF ? 0 : 1 + cpu->mmu.mbc.romOffset / 0x4000;
+  if (bank >= blocks.size()) {
+    blocks.resize(bank + 1);
+  }
+  if (blocks[bank].empty()) {
+    blocks[bank].assign(0x4000, nullptr);
+  }
+  return blocks[bank][pc & 0x3FFF];
+}
+
+// Make the code buffer read/write, or read/execute, if it isn't already.
+// If that fails the JIT turns itself off.
+bool JIT::protect(bool write) {
+#ifdef GB_JIT_X64
+  if (write != writable) {
+    int prot = PROT_READ | (write ? PROT_WRITE : PROT_EXEC);
+    if (mprotect(buffer, BUFFER_SIZE, prot) != 0) {
+      enabled = false;
+      return false;
+    }
+    writable = write;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Drop all compiled code and emit the entry and exit routines
+bool JIT::flush() {
+  if (!protect(true)) {
+    return false;
+  }
+  code = buffer;
+
+  // u32 enter(CPU *cpu, u8 *block, state *st)
+  emit8(0x53);                                  // push rbx
+  emit8(0x41), emit8(0x54);                     // push r12
+  emit8(0x41), emit8(0x55);                     // push r13
+  emit8(0x48), emit8(0x89), emit8(0xFB);        // mov rbx, rdi
+  emit8(0x49), emit8(0x89), emit8(0xD5);        // mov r13, rdx
+  emit8(0x45), emit8(0x31), emit8(0xE4);        // xor r12d, r12d
+  emit8(0xFF), emit8(0xE6);                     // jmp rsi
+  enter = (u32(*)(CPU *, u8 *, state *))buffer;
+
+  epilogue = code;
+  emit8(0x44), emit8(0x89), emit8(0xE0);  // mov eax, r12d
+  emit8(0x41), emit8(0x5D);               // pop r13
+  emit8(0x41), emit8(0x5C);               // pop r12
+  emit8(0x5B);                            // pop rbx
+  emit8(0xC3);                            // ret
+
+  blocks.clear();
+  romGeneration = cpu->mmu.romCodeGeneration;
+  flushes++;
+  return true;
+}
+
+// Compile the block starting at pc. Returns nullptr if its first instruction
+// can't be compiled.
+u8 *JIT::compile(u16 pc) {
+  if (buffer + BUFFER_SIZE - code < MAX_BLOCK_BYTES) {
+    flush();
+  }
+  u8 *start = code;
+  fixups.clear();
+
+  // Jumps within the block's own bank can be chained. A block in bank 0
+  // doesn't know which bank will be mapped at 0x4000 when it runs again.
+  bool banked = pc >= 0x4000;
+  u32 limit = banked ? 0x8000 : 0x4000;
+  auto chainable = [&](u16 target) {
+    return target <= 0x3FFF || (banked && target <= 0x7FFF);
+  };
+
+  s32 pcField = offset(&cpu->reg.pc);
+  u32 addr = pc;
+  u32 count = 0;
+  bool ended = false;
+  while (count < MAX_BLOCK_INSTRUCTIONS && addr < limit) {
+    CPU::decodedOp d = cpu->decode(addr);
+    if (addr + d.length > limit || !compilable(d.op)) {
+      break;
+    }
+    count++;
+    u8 op = d.op;
+    u16 next = addr + d.length;
+    u16 target = d.operand;
+    if (op == 0x18 || (op & 0xE7) == 0x20) {
+      target = next + (s8)d.operand;
+    }
+
+    if (emitInline(d)) {
+      u16 after = (op == 0x18 || op == 0xC3) ? target : next;
+      emit8(0x41), emit8(0x83), emit8(0xC4), emit8(d.cycles);  // add r12d, n
+      emit8(0x45), emit8(0x3B), emit8(0x65), emit8(0x00);  // cmp r12d, [r13]
+      fixups.push_back({emitJump(0x0F, 0x83), STUB_BUDGET, after, true,
+                        count});  // jae
+    } else {
+      emit8(0x48), emit8(0x89), emit8(0xDF);  // mov rdi, rbx
+      emit8(0xBE), emit32(d.operand);         // mov esi, operand
+      emit8(0xBA), emit32(addr);              // mov edx, pc
+      emit8(0x4C), emit8(0x89), emit8(0xE9);  // mov rcx, r13
+      emit8(0x48), emit8(0xB8);               // mov rax, jitStep<op>
+      emit64((u64)CPU::jitSteps[op]);
+      emit8(0xFF), emit8(0xD0);               // call rax
+      emit8(0x85), emit8(0xC0);               // test eax, eax
+      fixups.push_back({emitJump(0x0F, 0x84), STUB_GUARD, 0, false,
+                        count - 1});  // jz
+      emit8(0x41), emit8(0x01), emit8(0xC4);  // add r12d, eax
+      emit8(0x45), emit8(0x3B), emit8(0x65), emit8(0x00);  // cmp r12d, [r13]
+      fixups.push_back({emitJump(0x0F, 0x83), STUB_BUDGET, 0, false,
+                        count});  // jae
+    }
+    addr = next;
+
+    // Control flow ends the block
+    switch (op) {
+      case 0x18:  // JR
+      case 0xC3:  // JP
+      case 0xCD:  // CALL
+        emitCount(count);
+        emitExit(target, chainable(target));
+        ended = true;
+        break;
+
+      case 0x20: case 0x28: case 0x30: case 0x38:  // JR cc
+      case 0xC2: case 0xCA: case 0xD2: case 0xDA:  // JP cc
+      case 0xC4: case 0xCC: case 0xD4: case 0xDC: {  // CALL cc
+        // The handler has already set PC to one of two known addresses
+        emitCount(count);
+        emit8(0x66), emit8(0x81), emit8(0xBB), emit32(pcField);
+        emit16(target);                     // cmp word [rbx + pc], target
+        u8 *notTaken = emitJump(0x0F, 0x85);  // jne
+        emitExit(target, chainable(target));
+        s32 rel = code - (notTaken + 4);
+        memcpy(notTaken, &rel, 4);
+        emitExit(next, chainable(next));
+        ended = true;
+        break;
+      }
+
+      case 0xC0: case 0xC8: case 0xD0: case 0xD8: case 0xC9:  // RET
+      case 0xE9:                                              // JP (HL)
+      case 0xC7: case 0xCF: case 0xD7: case 0xDF:             // RST
+      case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+        emitCount(count);
+        emit8(0x41), emit8(0xC7), emit8(0x45), emit8(0x04);
+        emit32(EXIT_LOOKUP);  // mov dword [r13 + 4], EXIT_LOOKUP
+        emitJumpTo(epilogue);
+        ended = true;
+        break;
+
+      default:
+        break;
+    }
+    if (ended) {
+      break;
+    }
+  }
+
+  if (!count) {
+    code = start;
+    return nullptr;
+  }
+  if (!ended) {
+    emitCount(count);
+    emitExit(addr, chainable(addr));
+  }
+  emitStubs();
+  return start;
+}
+
+// Native code for instructions that only move registers around. Returns
+// false if op needs its handler.
+bool JIT::emitInline(const CPU::decodedOp &d) {
+  CPU::registers &reg = cpu->reg;
+  u8 *r8[8] = {&reg.b, &reg.c, &reg.d, &reg.e, &reg.h, &reg.l, nullptr, &reg.a};
+  u16 *r16[4] = {&reg.bc, &reg.de, &reg.hl, &reg.sp};
+  u8 op = d.op;
+
+  // NOP, and JR/JP whose only effect is the exit emitted after them
+  if (op == 0x00 || op == 0x18 || op == 0xC3) {
+    return true;
+  }
+
+  // LD r, n
+  if ((op & 0xC7) == 0x06 && op != 0x36) {
+    emit8(0xC6), emit8(0x83), emit32(offset(r8[op >> 3]));
+    emit8(d.operand);  // mov byte [rbx + r], n
+    return true;
+  }
+
+  // LD r, r'
+  if (op >= 0x40 && op <= 0x7F && (op & 7) != 6 && ((op >> 3) & 7) != 6) {
+    emit8(0x0F), emit8(0xB6), emit8(0x83);
+    emit32(offset(r8[op & 7]));  // movzx eax, byte [rbx + r']
+    emit8(0x88), emit8(0x83);
+    emit32(offset(r8[(op >> 3) & 7]));  // mov [rbx + r], al
+    return true;
+  }
+
+  // LD rr, nn
+  if ((op & 0xCF) == 0x01) {
+    emit8(0x66), emit8(0xC7), emit8(0x83), emit32(offset(r16[op >> 4]));
+    emit16(d.operand);  // mov word [rbx + rr], nn
+    return true;
+  }
+
+  // INC rr, DEC rr
+  if ((op & 0xC7) == 0x03) {
+    emit8(0x66), emit8(0xFF), emit8(op & 0x08 ? 0x8B : 0x83);
+    emit32(offset(r16[(op >> 4) & 3]));  // inc/dec word [rbx + rr]
+    return true;
+  }
+
+  return false;
+}
+
+// Leave the block for target: through a jump that run() can later point at
+// the target's block, or back to run() to look the target up
+void JIT::emitExit(u16 target, bool chain) {
+  if (chain) {
+    fixups.push_back({emitJump(0xE9), STUB_CHAIN, target, true, 0});
+    return;
+  }
+  emit8(0x66), emit8(0xC7), emit8(0x83), emit32(offset(&cpu->reg.pc));
+  emit16(target);  // mov word [rbx + pc], target
+  emit8(0x41), emit8(0xC7), emit8(0x45), emit8(0x04);
+  emit32(EXIT_LOOKUP);  // mov dword [r13 + 4], EXIT_LOOKUP
+  emitJumpTo(epilogue);
+}
+
+// Out of line exits for the block just compiled
+void JIT::emitStubs() {
+  for (const fixup &f : fixups) {
+    s32 rel = code - (f.rel + 4);
+    memcpy(f.rel, &rel, 4);
+
+    if (f.setPC) {
+      emit8(0x66), emit8(0xC7), emit8(0x83), emit32(offset(&cpu->reg.pc));
+      emit16(f.pc);  // mov word [rbx + pc], pc
+    }
+    u32 exit = EXIT_BUDGET;
+    if (f.kind == STUB_GUARD) {
+      exit = EXIT_GUARD;
+    } else if (f.kind == STUB_CHAIN) {
+      exit = EXIT_CHAIN;
+      emit8(0x48), emit8(0xB8), emit64((u64)f.rel);  // mov rax, jump
+      emit8(0x49), emit8(0x89), emit8(0x45), emit8(0x08);  // mov [r13 + 8], rax
+    }
+    emitCount(f.count);
+    emit8(0x41), emit8(0xC7), emit8(0x45), emit8(0x04);
+    emit32(exit);  // mov dword [r13 + 4], exit
+    emitJumpTo(epilogue);
+  }
+}
+
+void JIT::emit8(u8 b) { *code++ = b; }
+
+void JIT::emit16(u16 w) {
+  memcpy(code, &w, 2);
+  code += 2;
+}
+
+void JIT::emit32(u32 d) {
+  memcpy(code, &d, 4);
+  code += 4;
+}
+
+void JIT::emit64(u64 q) {
+  memcpy(code, &q, 8);
+  code += 8;
+}
+
+// Emit a jump opcode with a zero rel32 and return the address of the rel32
+u8 *JIT::emitJump(u8 op1, u8 op2) {
+  emit8(op1);
+  if (op2) {
+    emit8(op2);
+  }
+  u8 *rel = code;
+  emit32(0);
+  return rel;
+}
+
+// add dword [r13 + 0x10], count
+void JIT::emitCount(u32 count) {
+  if (count) {
+    emit8(0x41), emit8(0x83), emit8(0x45), emit8(0x10), emit8(count);
+  }
+}
+
+// jmp target
+void JIT::emitJumpTo(const u8 *target) {
+  u8 *rel = emitJump(0xE9);
+  s32 d = target - (rel + 4);
+  memcpy(rel, &d, 4);
+}
+
+// Displacement of a CPU member from rbx
+s32 JIT::offset(const void *field) {
+  return (const u8 *)field - (const u8 *)cpu;
+}
@@ -0,0 +1,88 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: jit.hpp
+// Description: x86-64 dynamic recompiler
+//
+// Translates blocks of ROM code to native code, chains blocks together and
+// runs them against a cycle budget. Anything it can't do is left to
+// CPU::execute().
+
+#ifndef GB_JIT
+#define GB_JIT
+
+#include <vector>
+#include "common.hpp"
+#include "cpu.hpp"
+
+// Native code generation needs x86-64 and memory we can execute. Build with
+// GB_NO_JIT to leave it out; run() then always returns 0.
+#if defined(__x86_64__) && !defined(__EMSCRIPTEN__) && !defined(GB_NO_JIT)
+#define GB_JIT_X64
+#endif
+
+class JIT {
+ public:
+  JIT(CPU *cpu);
+  ~JIT();
+
+  // Run compiled code from reg.pc until at least budget cycles have passed,
+  // an interrupt is due or the code needs the interpreter. Call it in place
+  // of CPU::execute() after checkInterrupts(). Returns the cycles run, or 0
+  // if execute() has to run the next instruction.
+  u32 run(int budget);
+
+  CPU *cpu;
+  bool enabled;
+  u64 instructions;  // executed by compiled code
+
+  // Shared with compiled code, which keeps a pointer to it in r13
+  enum { EXIT_BUDGET, EXIT_GUARD, EXIT_LOOKUP, EXIT_CHAIN };
+  struct state {
+    u32 budget;        // 0x00: cycles left
+    u32 exit;          // 0x04: why compiled code returned
+    u8 *patch;         // 0x08: jump to point at reg.pc, for EXIT_CHAIN
+    u32 instructions;  // 0x10
+  } st;
+
+ private:
+  u8 *buffer;     // code buffer; starts with the entry and exit routines
+  u8 *code;       // next free byte in buffer
+  bool writable;  // buffer is read/write, not read/execute
+  u8 *epilogue;
+  u32 (*enter)(CPU *cpu, u8 *block, state *st);
+  u32 flushes;  // bumped whenever buffer is cleared
+
+  // Compiled blocks, indexed like CPU::romBlocks. FAILED marks a pc whose
+  // first instruction can't be compiled.
+  std::vector<std::vector<u8 *>> blocks;
+  static u8 *const FAILED;
+  u32 romGeneration;
+
+  u8 *&block(u16 pc);
+  u8 *compile(u16 pc);
+  bool protect(bool write);
+  bool flush();
+
+  // Code emission
+  struct fixup {
+    u8 *rel;  // rel32 to point at the stub
+    u8 kind;
+    u16 pc;    // PC to store, for exits after inlined instructions
+    bool setPC;
+    u32 count;  // instructions done when the stub runs
+  };
+  std::vector<fixup> fixups;
+
+  void emit8(u8 b);
+  void emit16(u16 w);
+  void emit32(u32 d);
+  void emit64(u64 q);
+  u8 *emitJump(u8 op1, u8 op2 = 0);
+  void emitJumpTo(const u8 *target);
+  void emitCount(u32 count);
+  void emitExit(u16 target, bool chain);
+  bool emitInline(const CPU::decodedOp &d);
+  void emitStubs();
+  s32 offset(const void *field);
+};
+
+#endif
@@ -5,12 +5,11 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
 #include <set>
+#include <string>
 #include "common.hpp"
-#include "cpu.hpp"
-#include "gpu.hpp"
+#include "gameboy.hpp"
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_sdl.h"
-#include "joypad.hpp"
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
@@ -24,9 +23,15 @@
 
 void main_loop();
 // These are global because emscripten's main_loop() can't have parameters
-CPU g_cpu;
-GPU g_gpu;
-Joypad g_joypad;
+Gameboy g_gameboy;
+CPU &g_cpu = g_gameboy.cpu;
+GPU &g_gpu = g_gameboy.gpu;
+Joypad &g_joypad = g_gameboy.joypad;
+JIT &g_jit = g_gameboy.jit;
+Scheduler &g_scheduler = g_gameboy.scheduler;
+
+// rom.sav for rom.gb, where battery-backed RAM is saved
+std::string saveFilename(const char* romFilename);
 
 // Window rendering functions
 void imguiLCD();
@@ -72,27 +77,32 @@ void main_loop() {
 
   handleSdlEvents();
 
-  // Run the emulator until vsync or breakpoint
-  while ((g_running || g_stepping) && !g_gpu.vsync) {
+  // Run the emulator until vsync or breakpoint. Compiled code and
+  // superinstructions run past breakpoints, so with any set, or when
+  // stepping, it's one instruction at a time.
+  if (g_running && g_breakpoints.empty()) {
+    g_gameboy.runUntilVSync();
     g_disasm.knownEntryPoints.insert(g_cpu.reg.pc);
+  } else {
+    while ((g_running || g_stepping) && !g_gpu.vsync) {
+      if (g_stepping) {
+        g_stepping = false;
+        g_scrollDisasmToPC = true;
+      }
 
-    if (g_stepping) {
-      g_stepping = false;
-      g_scrollDisasmToPC = true;
-    }
-
-    g_cpu.checkInterrupts();
-    g_cpu.execute();
-    g_gpu.step(g_cpu.cpu_clock_t);
+      g_disasm.knownEntryPoints.insert(g_cpu.reg.pc);
+      g_gameboy.step();
 
-    // Check for breakpoint
-    if (g_breakpoints.find(g_cpu.reg.pc) != g_breakpoints.end()) {
-      g_running = false;
-      g_scrollDisasmToPC = true;
-      g_fullscreenLcd = false;
+      // Check for breakpoint
+      if (g_breakpoints.find(g_cpu.reg.pc) != g_breakpoints.end()) {
+        g_running = false;
+        g_scrollDisasmToPC = true;
+        g_fullscreenLcd = false;
+      }
     }
+    g_gpu.vsync = false;
+    g_cpu.mmu.syncRAM();
   }
-  g_gpu.vsync = false;
 
   // Render GUI windows
   imguiLCD();
@@ -122,14 +132,10 @@ void main_loop() {
 
 // Load ROM, set up SDL/ImGui, main loop till quit, cleanup ImGui/SDL
 int main(int argc, char** argv) {
-  // Initialize emulator components
-  g_gpu.mmu = &g_cpu.mmu;
-  g_cpu.mmu.joypad = &g_joypad;
-  g_gpu.reset();
-
   // Load ROM
 #ifdef __EMSCRIPTEN__
-  if (!g_cpu.mmu.load("roms/tetris.gb")) {
+  if (!g_gameboy.load("roms/tetris.gb",
+                      saveFilename("roms/tetris.gb").c_str())) {
     printf("Invalid ROM file: roms/tetris.gb\n");
     return -1;
   }
@@ -138,7 +144,7 @@ int main(int argc, char** argv) {
     printf("Please specify a ROM file.\n");
     return -1;
   }
-  if (!g_cpu.mmu.load(argv[1])) {
+  if (!g_gameboy.load(argv[1], saveFilename(argv[1]).c_str())) {
     printf("Invalid ROM file: %s\n", argv[1]);
     return -1;
   }
@@ -300,6 +306,7 @@ void imguiRegisters() {
   ImGui::SetNextWindowSize(ImVec2(REG_WINDOW_WIDTH, REG_WINDOW_HEIGHT));
   ImGui::Begin("reg", nullptr,
                ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize);
+  g_cpu.syncFlags();  // F is computed lazily
   ImGui::Text(
       "af = %04X\nbc = %04X\nde = %04X\nhl = %04X\nsp = %04X\npc = %04X",
       g_cpu.reg.af, g_cpu.reg.bc, g_cpu.reg.de, g_cpu.reg.hl, g_cpu.reg.sp,
@@ -327,9 +334,9 @@ void imguiLcdStatus() {
       "%02X FF49 OBP1\n"
       "%02X FF4A WY\n"
       "%02X FF4B WX\n",
-      g_cpu.mmu.memory[0xFF40], g_cpu.mmu.memory[0xFF41],
+      g_cpu.mmu.memory[0xFF40], g_cpu.mmu.read8(0xFF41),
       g_cpu.mmu.memory[0xFF42], g_cpu.mmu.memory[0xFF43],
-      g_cpu.mmu.memory[0xFF44], g_cpu.mmu.memory[0xFF45],
+      g_cpu.mmu.read8(0xFF44), g_cpu.mmu.memory[0xFF45],
       g_cpu.mmu.memory[0xFF46], g_cpu.mmu.memory[0xFF47],
       g_cpu.mmu.memory[0xFF48], g_cpu.mmu.memory[0xFF49],
       g_cpu.mmu.memory[0xFF4A], g_cpu.mmu.memory[0xFF4B]);
@@ -470,7 +477,13 @@ void imguiHelp() {
       "Select: space\n"
       "Start: enter\n"
       "Directions: arrows\n"
-      "Fullscreen: f\n");
+      "Fullscreen: f\n"
+      "JIT on/off: j\n"
+      "Idle loop skipping on/off: i\n"
+      "Bulk copies and fills on/off: m\n");
+  ImGui::Text("Cycles: %llu", (unsigned long long)g_scheduler.now);
+  ImGui::Text("Idle cycles skipped: %llu",
+              (unsigned long long)g_cpu.idleCycles);
   ImGui::End();
 }
 
@@ -532,29 +545,56 @@ void handleKeyPress(SDL_Keycode key) {
       g_scrollDisasmToPC = true;
       break;
 
+    // Toggle the recompiler (stays off if the platform has none)
+    case SDLK_j:
+#ifdef GB_JIT_X64
+      g_jit.enabled = !g_jit.enabled;
+#endif
+      break;
+
+    // Toggle idle loop skipping
+    case SDLK_i:
+      g_cpu.idleSkip = !g_cpu.idleSkip;
+      break;
+
+    // Toggle running copy and fill loops in bulk
+    case SDLK_m:
+      g_cpu.bulkCopy = !g_cpu.bulkCopy;
+      break;
+
     default:
       break;
   }
 }
 
+std::string saveFilename(const char* romFilename) {
+  std::string save = romFilename;
+  size_t dot = save.find_last_of("./");
+  if (dot != std::string::npos && save[dot] == '.') {
+    save.erase(dot);
+  }
+  return save + ".sav";
+}
+
 // This is a ugly, ugly hack
 void disassemble(CPU& cpu, u16& pc) {
   g_disasm.address = pc;
-  g_disasm.opcode = cpu.mmu.memory[pc];
+  g_disasm.opcode = cpu.mmu.fetch8(pc);
   g_disasm.operandSize = 0;
   g_disasm.operand = 0;
 
   if (g_disasm.opcode == 0xCB) {
     g_disasm.operandSize = 1;
-    g_disasm.operand = cpu.mmu.memory[++pc];
+    g_disasm.operand = cpu.mmu.fetch8(++pc);
     g_disasm.str = cpu.instructions_CB[g_disasm.operand].disassembly;
   } else if (cpu.instructions[g_disasm.opcode].operandLength == 1) {
     g_disasm.operandSize = 1;
-    g_disasm.operand = cpu.mmu.memory[++pc];
+    g_disasm.operand = cpu.mmu.fetch8(++pc);
     g_disasm.str = cpu.instructions[g_disasm.opcode].disassembly;
   } else if (cpu.instructions[g_disasm.opcode].operandLength == 2) {
     g_disasm.operandSize = 2;
-    g_disasm.operand = cpu.mmu.read16(++pc);
+    ++pc;
+    g_disasm.operand = cpu.mmu.fetch8(pc) | cpu.mmu.fetch8(pc + 1) << 8;
     g_disasm.str = cpu.instructions[g_disasm.opcode].disassembly;
     pc++;
   } else {
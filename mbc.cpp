@@ -0,0 +1,192 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: mbc.cpp
+// Description: Cartridge memory bank controllers
+
+#include <algorithm>
+#include <cstring>
+#include "mbc.hpp"
+
+MBC::MBC() { reset(0, 0, 0); }
+
+/*
+0147 - Cartridge Type
+ 00 ROM ONLY                 0F MBC3+TIMER+BATTERY
+ 01 MBC1                     10 MBC3+TIMER+RAM+BATTERY
+ 02 MBC1+RAM                 11 MBC3
+ 03 MBC1+RAM+BATTERY         12 MBC3+RAM
+ 05 MBC2                     13 MBC3+RAM+BATTERY
+ 06 MBC2+BATTERY             19 MBC5
+ 08 ROM+RAM                  1A MBC5+RAM
+ 09 ROM+RAM+BATTERY          1B MBC5+RAM+BATTERY
+                             1C-1E MBC5+RUMBLE, +RAM, +RAM+BATTERY
+Anything else is treated as ROM only.
+
+0149 - RAM Size
+ 00 None, 01 2KB, 02 8KB, 03 32KB (4 banks), 04 128KB (16 banks),
+ 05 64KB (8 banks). MBC2 always has 512 half-bytes built in.
+*/
+void MBC::reset(u8 type, u8 ramCode, u32 romSize) {
+  this->type = type;
+  if (type >= 0x01 && type <= 0x03) {
+    kind = MBC1;
+  } else if (type == 0x05 || type == 0x06) {
+    kind = MBC2;
+  } else if (type >= 0x0F && type <= 0x13) {
+    kind = MBC3;
+  } else if (type >= 0x19 && type <= 0x1E) {
+    kind = MBC5;
+  } else {
+    kind = NONE;
+  }
+  static const u8 batteries[] = {0x03, 0x06, 0x09, 0x0F, 0x10,
+                                 0x13, 0x1B, 0x1E};
+  const u8 *end = batteries + sizeof(batteries);
+  battery = std::find(batteries, end, type) != end;
+  rumble = type >= 0x1C && type <= 0x1E;
+
+  static const u32 ramSizes[6] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+  if (kind == MBC2) {
+    ramSize = 0x200;
+  } else {
+    ramSize = ramCode < 6 ? ramSizes[ramCode] : 0;
+  }
+  ramMask = ramSize ? std::min<u32>(ramSize, 0x2000) - 1 : 0;
+  romBanks = std::max<u32>((romSize + 0x3FFF) / 0x4000, 2);
+
+  ramEnabled = kind == NONE;
+  romBank = 1;
+  ramBank = 0;
+  mode = 0;
+
+  memset(rtc, 0, sizeof(rtc));
+  memset(latched, 0, sizeof(latched));
+  rtcBase = time(nullptr);
+
+  map();
+}
+
+bool MBC::write(u16 addr, u8 value) {
+  u32 rom0 = rom0Offset, rom = romOffset, ram = ramOffset;
+  bool ramWas = ramMapped, rtcWas = rtcMapped;
+
+  switch (kind) {
+    case NONE:
+      return false;
+
+    // 0000-1FFF RAM enable, 2000-3FFF ROM bank bits 0-4, 4000-5FFF ROM bank
+    // bits 5-6 or RAM bank, 6000-7FFF which of the two 4000-5FFF selects
+    case MBC1:
+      if (addr <= 0x1FFF) {
+        ramEnabled = (value & 0x0F) == 0x0A;
+      } else if (addr <= 0x3FFF) {
+        romBank = value & 0x1F ? value & 0x1F : 1;
+      } else if (addr <= 0x5FFF) {
+        ramBank = value & 3;
+      } else {
+        mode = value & 1;
+      }
+      break;
+
+    // 0000-3FFF RAM enable if address bit 8 is clear, else ROM bank
+    case MBC2:
+      if (addr <= 0x3FFF) {
+        if (addr & 0x100) {
+          romBank = value & 0x0F ? value & 0x0F : 1;
+        } else {
+          ramEnabled = (value & 0x0F) == 0x0A;
+        }
+      }
+      break;
+
+    // 0000-1FFF RAM and clock enable, 2000-3FFF ROM bank, 4000-5FFF RAM bank
+    // or clock register, 6000-7FFF latch the clock by writing 0 then 1
+    case MBC3:
+      if (addr <= 0x1FFF) {
+        ramEnabled = (value & 0x0F) == 0x0A;
+      } else if (addr <= 0x3FFF) {
+        romBank = value & 0x7F ? value & 0x7F : 1;
+      } else if (addr <= 0x5FFF) {
+        ramBank = value & 0x0F;
+      } else {
+        if (mode == 0 && value == 1) {
+          syncRTC();
+          memcpy(latched, rtc, sizeof(rtc));
+        }
+        mode = value;
+      }
+      break;
+
+    // 0000-1FFF RAM enable, 2000-2FFF ROM bank bits 0-7, 3000-3FFF ROM bank
+    // bit 8, 4000-5FFF RAM bank. Bank 0 can be mapped at 4000-7FFF too. On
+    // rumble carts bit 3 of the RAM bank drives the motor instead.
+    case MBC5:
+      if (addr <= 0x1FFF) {
+        ramEnabled = (value & 0x0F) == 0x0A;
+      } else if (addr <= 0x2FFF) {
+        romBank = (romBank & 0x100) | value;
+      } else if (addr <= 0x3FFF) {
+        romBank = (romBank & 0xFF) | (value & 1) << 8;
+      } else if (addr <= 0x5FFF) {
+        ramBank = value & (rumble ? 0x07 : 0x0F);
+      }
+      break;
+  }
+
+  map();
+  return rom0 != rom0Offset || rom != romOffset || ram != ramOffset ||
+         ramWas != ramMapped || rtcWas != rtcMapped;
+}
+
+// Work out the offsets from the bank registers. Bank numbers wrap at the
+// size of the ROM or RAM, as the unconnected address lines are ignored.
+void MBC::map() {
+  u32 bank = romBank;
+  u32 bank0 = 0;
+  u32 bankRAM = ramBank;
+  if (kind == MBC1) {
+    bank = ramBank << 5 | romBank;
+    if (mode) {
+      bank0 = ramBank << 5;
+    } else {
+      bankRAM = 0;
+    }
+  }
+  romOffset = bank % romBanks * 0x4000;
+  rom0Offset = bank0 % romBanks * 0x4000;
+  ramOffset = bankRAM % std::max<u32>(ramSize / 0x2000, 1) * 0x2000;
+
+  rtcMapped = kind == MBC3 && ramEnabled && ramBank >= 0x08 && ramBank <= 0x0C;
+  ramMapped = ramEnabled && ramSize && (kind != MBC3 || ramBank <= 3);
+}
+
+u8 MBC::readRTC() { return latched[ramBank - 0x08]; }
+
+void MBC::writeRTC(u8 value) {
+  static const u8 masks[5] = {0x3F, 0x3F, 0x1F, 0xFF, 0xC1};
+  syncRTC();
+  rtc[ramBank - 0x08] = value & masks[ramBank - 0x08];
+}
+
+// Add the host seconds since rtcBase to the clock, unless it's halted (DH
+// bit 6). Days count to 511, then set the carry (DH bit 7) and wrap.
+void MBC::syncRTC() {
+  time_t now = time(nullptr);
+  u64 elapsed = now > rtcBase ? now - rtcBase : 0;
+  rtcBase = now;
+  if (!elapsed || bitTest(rtc[RTC_DH], 6)) {
+    return;
+  }
+  u64 days = rtc[RTC_DL] | (rtc[RTC_DH] & 1) << 8;
+  u64 total = rtc[RTC_S] + rtc[RTC_M] * 60 + rtc[RTC_H] * 3600 +
+              days * 86400 + elapsed;
+  rtc[RTC_S] = total % 60;
+  rtc[RTC_M] = total / 60 % 60;
+  rtc[RTC_H] = total / 3600 % 24;
+  days = total / 86400;
+  if (days > 511) {
+    bitSet(rtc[RTC_DH], 7);
+    days &= 511;
+  }
+  rtc[RTC_DL] = days & 0xFF;
+  rtc[RTC_DH] = (rtc[RTC_DH] & 0xFE) | days >> 8;
+}
@@ -0,0 +1,63 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: mbc.hpp
+// Description: Cartridge memory bank controllers
+//
+// The cartridge type at 0x147 picks the controller and 0x149 the size of its
+// RAM. Writes to 0000-7FFF go to write(), which works out which ROM and RAM
+// banks are mapped; the MMU then points its pages at them, so a bank switch
+// costs nothing on later reads.
+
+#ifndef GB_MBC
+#define GB_MBC
+
+#include <ctime>
+#include "common.hpp"
+
+class MBC {
+ public:
+  MBC();
+
+  enum controller { NONE, MBC1, MBC2, MBC3, MBC5 };
+
+  // Pick the controller for the ROM's header and map its first banks
+  void reset(u8 type, u8 ramCode, u32 romSize);
+
+  // Handle a write to 0000-7FFF. Returns true if the mapping changed.
+  bool write(u16 addr, u8 value);
+
+  u8 type;  // cartridge type, from 0x147
+  controller kind;
+  bool battery;  // RAM (and the MBC3 clock) is kept when the power is off
+  bool rumble;   // MBC5 with a rumble motor
+  u32 ramSize;   // bytes of external RAM; MBC2's 512 half-bytes count whole
+
+  // The current mapping, as offsets into the ROM and RAM
+  u32 rom0Offset;  // ROM at 0000-3FFF
+  u32 romOffset;   // ROM at 4000-7FFF
+  u32 ramOffset;   // RAM at A000-BFFF, which repeats every ramMask + 1 bytes
+  u32 ramMask;
+  bool ramMapped;  // RAM is enabled and selected
+  bool rtcMapped;  // an MBC3 clock register is enabled and selected instead
+
+  // MBC3 clock register reads and writes at A000-BFFF
+  u8 readRTC();
+  void writeRTC(u8 value);
+
+ private:
+  u32 romBanks;  // 16KB banks in the ROM
+  bool ramEnabled;
+  u16 romBank;  // MBC1: low 5 bits only
+  u8 ramBank;   // MBC1: the 2-bit register that also holds ROM bank bits
+  u8 mode;      // MBC1 banking mode; MBC3 last latch write
+  void map();
+
+  // MBC3 clock: seconds, minutes, hours, day low, day high. rtc counts from
+  // rtcBase, host time; latched is what reads see.
+  enum { RTC_S, RTC_M, RTC_H, RTC_DL, RTC_DH };
+  u8 rtc[5];
+  u8 latched[5];
+  time_t rtcBase;
+  void syncRTC();
+};
+
+#endif
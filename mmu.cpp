@@ -4,178 +4,305 @@
 //
 // Memory map, BIOS and ROM file loading, DMA
 
+#include <algorithm>
+#include <cstring>
 #include "mmu.hpp"
+#include "gpu.hpp"
+#include "scheduler.hpp"
+#include "timer.hpp"
 
-MMU::MMU() { reset(); }
+MMU::MMU() {
+  romFilename = nullptr;
+  rom = nullptr;
+  romSize = 0;
+  mapIO();
+  reset();
+}
 
 void MMU::reset() {
   memory.resize(0x10000, 0);
-  ram.resize(0x2000, 0);  // external RAM
 
-  // Setup MBC info
-  mbc.romOffset = 0x4000;
-  mbc.romBank = 0;
-  mbc.mode = 0;
-  mbc.ramOffset = 0;
-  mbc.type = 0;  // this will be determined in load()
-}
+  ioWritten = false;
+  accessOffset = 0;
+  dmaActive = false;
+  updatePending();
 
-bool MMU::load(char *filename) {
-  romFilename = filename;
+  codeMap.assign(0x10000, 0);
+  std::fill_n(codePages, 256, false);
+  codeGeneration = 0;
+  romCodeGeneration = 0;
+  ramCodeGeneration = 0;
+  mapCartridge();
+}
 
-  std::ifstream file;
-  file.open(filename, std::ios::binary);
-  if (!file.is_open()) {
+bool MMU::load(char *filename, const char *saveFilename) {
+  std::shared_ptr<const ROM> file = ROM::open(filename);
+  if (!file) {
     return false;
   }
+  load(file, saveFilename);
+  romFilename = filename;
+  return true;
+}
 
-  // Get file size and read ROM into vector
-  file.seekg(0, file.end);
-  u32 romSize = file.tellg();
-  rom.resize(romSize, 0);
-  file.seekg(0, file.beg);
-  file.read((char *)(&rom[0]), romSize);
-  file.close();
+// Bank 0 is read from the ROM like every other bank, so nothing is copied
+void MMU::load(std::shared_ptr<const ROM> cartridge, const char *saveFilename) {
+  romFilename = nullptr;
+  this->saveFilename = saveFilename ? saveFilename : "";
+  this->cartridge = cartridge;
+  rom = cartridge->data();
+  romSize = cartridge->size();
 
-  // Map ROM to memory
-  memory.assign(rom.begin(),
-                rom.begin() + (0x7FFF > rom.size() ? rom.size() : 0x7FFF));
+  mapCartridge();
 
-  // Get MBC type from ROM header
-  mbc.type = rom[0x147];
+  // Anything decoded from a previous ROM is stale
+  romCodeGeneration++;
+  codeGeneration++;
+}
 
-  return true;
+/*
+Read pages:
+0000-3FFF: ROM bank 0, or another in MBC1's second banking mode
+4000-7FFF: switched ROM bank
+8000-9FFF: VRAM
+A000-BFFF: switched external RAM bank
+C000-DFFF: WRAM
+E000-FDFF: shadow of WRAM, less final 512 bytes
+FE00-FEFF: OAM
+FF00-FFFF: I/O, HRAM and IE, always handled
+
+Write pages are the same, except that writes to ROM go to the MBC and writes
+to the WRAM shadow have to check for decoded code, so both are handled.
+*/
+void MMU::mapPages() {
+  for (u32 page = 0; page < 0x100; page++) {
+    bool shadow = page >= 0xE0 && page < 0xFE;
+    u8 *host = &memory[(shadow ? page - 0x20 : page) << 8];
+    bool plain = (page >= 0x80 && page < 0xE0) || page == 0xFE;
+    bool locked = dmaActive && page < 0xFF;
+    readPages[page] = page < 0xFF && !locked ? host : nullptr;
+    writePages[page] = plain && !locked && !codePages[page] ? host : nullptr;
+  }
+  mapBanks();
 }
 
-u8 MMU::read8(u16 addr) {
-  // ROM, switched bank
-  if (addr >= 0x4000 && addr <= 0x7FFF) {
-    return rom[mbc.romOffset + (addr & 0x3FFF)];
+// Set up the MBC and external RAM for the ROM's header, if there's a ROM.
+// Battery-backed RAM is kept in saveFilename, if there is one.
+void MMU::mapCartridge() {
+  bool header = romSize >= 0x150;
+  mbc.reset(header ? rom[0x147] : 0, header ? rom[0x149] : 0, romSize);
+  bool save = mbc.battery && !saveFilename.empty();
+  ram.open(save ? saveFilename.c_str() : nullptr, mbc.ramSize);
+  mapPages();
+}
+
+void MMU::syncRAM() {
+  if (ram.sync()) {
+    mapBanks();  // so the next write to each page marks it again
   }
+}
 
-  // RAM, switched bank
-  else if (addr >= 0xA000 && addr <= 0x8FFF) {
-    return ram[mbc.ramOffset + (addr & 0x1FFF)];
+// ROM pages at the MBC's offsets, and RAM pages unless it's disabled or a
+// clock register is selected. MBC2 RAM only has the low half of each byte,
+// so it's read and written through the handlers. So are writes to saved RAM
+// pages that haven't been marked dirty yet.
+void MMU::mapBanks() {
+  if (dmaActive) {
+    return;  // all locked out
+  }
+  for (u32 page = 0; page < 0x80; page++) {
+    u32 offset = (page < 0x40 ? mbc.rom0Offset : mbc.romOffset) +
+                 ((page & 0x3F) << 8);
+    bool there = offset + 0x100 <= romSize;
+    readPages[page] = there ? &rom[offset] : nullptr;
   }
+  for (u32 page = 0; page < 0x20; page++) {
+    u32 offset = mbc.ramOffset + ((page << 8) & mbc.ramMask);
+    u8 *host = mbc.ramMapped ? &ram[offset] : nullptr;
+    bool half = mbc.kind == MBC::MBC2;
+    bool handled = half || (host && ram.clean(offset));
+    readPages[0xA0 + page] = half ? nullptr : host;
+    writePages[0xA0 + page] = handled ? nullptr : host;
+  }
+}
 
-  // Shadow of working RAM, less final 512 bytes
-  else if (addr >= 0xE000 && addr <= 0xFDFF) {
-    return memory[addr - 0x1000];
+// read8() as if OAM DMA weren't running. Instruction fetches use it, since
+// blocks are decoded once and cached; code keeps to HRAM during DMA anyway.
+u8 MMU::fetch8(u16 addr) {
+  if (!dmaActive || addr >= 0xFF00) {
+    return read8(addr);
   }
+  if (addr <= 0x7FFF) {
+    u32 offset = (addr <= 0x3FFF ? mbc.rom0Offset : mbc.romOffset) +
+                 (addr & 0x3FFF);
+    return offset < romSize ? rom[offset] : 0xFF;
+  }
+  if (addr >= 0xA000 && addr <= 0xBFFF) {
+    return readCartRAM(addr);
+  }
+  if (addr >= 0xE000 && addr <= 0xFDFF) {
+    addr -= 0x2000;
+  }
+  return memory[addr];
+}
 
-  // Joypad
-  else if (addr == 0xFF00) {
-    return joypad->read(memory[0xFF00]);
+// A000-BFFF: an MBC3 clock register, or RAM. MBC2 RAM has 4 bits; the top
+// half of the byte reads as 1s.
+u8 MMU::readCartRAM(u16 addr) {
+  if (mbc.rtcMapped) {
+    return mbc.readRTC();
+  }
+  if (!mbc.ramMapped) {
+    return 0xFF;
   }
+  u8 value = ram[mbc.ramOffset + (addr & mbc.ramMask)];
+  return mbc.kind == MBC::MBC2 ? value | 0xF0 : value;
+}
 
-  // Default
-  else {
-    return memory[addr];
+// Pages without host memory: nothing there, OAM DMA, the MBC3 clock, MBC2
+// RAM, I/O and HRAM
+u8 MMU::readHandler(u16 addr) {
+  if (addr < 0xFF00) {
+    bool cart = addr >= 0xA000 && addr <= 0xBFFF;
+    return cart && !dmaActive ? readCartRAM(addr) : 0xFF;
   }
+  if (addr < 0xFF80) {
+    ioRead read = ioReads[addr & 0x7F];
+    return read ? (this->*read)(addr) : memory[addr];
+  }
+  return memory[addr];
 }
 
 u16 MMU::read16(u16 addr) { return (read8(addr + 1) << 8 | read8(addr)); }
 
-void MMU::write8(u16 addr, u8 value) {
-  // External RAM switch
-  if (addr <= 0x1FFF) {
-  }
-
-  // ROM
-  else if (addr >= 0x2000 && addr <= 0x3FFF) {
-    switch (mbc.type) {
-      case 1:
-      case 2:
-      case 3:
-        value &= 0x0F;
-        if (!value) {
-          value = 1;
-        }
-        mbc.romBank = (mbc.romBank & 0x60) + value;
-        mbc.romOffset = mbc.romBank * 0x4000;
-        break;
-      default:
-        break;
+void MMU::writeHandler(u16 addr, u8 value) {
+  // HRAM shares its page with I/O, so take it first
+  if (addr >= 0xFF80 && addr != IE) {
+    if (codeMap[addr]) {
+      invalidateCode();
     }
+    memory[addr] = value;
+    return;
   }
-
-  // RAM
-  else if (addr >= 0x4000 && addr <= 0x5FFF) {
-    switch (mbc.type) {
-      case 1:
-      case 2:
-      case 3:
-        // RAM bank
-        if (mbc.mode) {
-          mbc.ramOffset = (value & 3) * 0x2000;
-        } else {
-          // ROM bank
-          mbc.romBank = (mbc.romBank & 0x1F) + ((value & 3) << 5);
-          mbc.romOffset = mbc.romBank * 0x4000;
-        }
-        break;
-      default:
-        break;
+  if (addr >= 0xFF00) {
+    ioWritten = true;
+    if (addr == IE) {
+      memory[addr] = value;
+      updatePending();
+      return;
+    }
+    ioWrite write = ioWrites[addr & 0x7F];
+    if (write) {
+      (this->*write)(addr, value);
+    } else {
+      memory[addr] = value;
     }
+    return;
+  }
+  if (dmaActive) {
+    return;  // OAM DMA has the buses
   }
 
-  else if (addr >= 0x6000 && addr <= 0x7FFF) {
-    switch (mbc.type) {
-      case 2:
-      case 3:
-        mbc.mode = value & 1;
-        break;
-      default:
-        break;
+  // MBC control. A new ROM bank at 0000-3FFF is new code at the same
+  // addresses, so the ROM's decoded blocks go too.
+  if (addr <= 0x7FFF) {
+    u32 rom0 = mbc.rom0Offset;
+    if (mbc.write(addr, value)) {
+      if (mbc.rom0Offset != rom0) {
+        romCodeGeneration++;
+      }
+      codeGeneration++;
+      mapBanks();
     }
   }
 
-  // RAM, external
+  // RAM, external: MBC2 RAM, which keeps 4 bits, and clock registers
   else if (addr >= 0xA000 && addr <= 0xBFFF) {
-    ram[mbc.ramOffset + (addr & 0x1FFF)] = value;
+    if (mbc.rtcMapped) {
+      mbc.writeRTC(value);
+    } else if (mbc.ramMapped) {
+      u32 offset = mbc.ramOffset + (addr & mbc.ramMask);
+      bool half = mbc.kind == MBC::MBC2;
+      ram[offset] = half ? value | 0xF0 : value;
+      if (ram.clean(offset)) {
+        ram.mark(offset);
+        mapBanks();
+      }
+    }
   }
 
   // WRAM shadow
   else if (addr >= 0xE000 && addr <= 0xFDFF) {
-    memory[addr - 0x1000] = value;
+    if (codeMap[addr - 0x2000]) {
+      invalidateCode();
+    }
+    memory[addr - 0x2000] = value;
   }
 
-  // Writes to DIV reset it to zero
-  else if (addr == DIV) {
-    memory[DIV] = 0;
+  // Default
+  else {
+    if (codeMap[addr]) {
+      invalidateCode();
+    }
+    memory[addr] = value;
   }
+}
 
-  // Joypad class handles its register
-  else if (addr == JOYP) {
-    memory[addr] = joypad->read(value);
-  }
+// Registers with side effects, or kept outside memory, get handlers in
+// ioReads and ioWrites. The rest are plain bytes of memory.
+void MMU::mapIO() {
+  std::fill_n(ioReads, 0x80, nullptr);
+  std::fill_n(ioWrites, 0x80, nullptr);
 
-  // CPU IF always polls high on bits 5-7
-  else if (addr == IF) {
-    value |= 0xE0;
-    memory[addr] = value;
+  ioReads[JOYP & 0x7F] = &MMU::readJoypad;
+  ioWrites[JOYP & 0x7F] = &MMU::writeJoypad;
+  for (u16 addr = DIV; addr <= TAC; addr++) {
+    ioWrites[addr & 0x7F] = &MMU::writeTimer;
   }
-
-  // Writes to current scanline register reset it
-  else if (addr == LY) {
-    memory[addr] = 0;
+  ioReads[DIV & 0x7F] = &MMU::readTimer;
+  ioReads[TIMA & 0x7F] = &MMU::readTimer;
+  ioWrites[IF & 0x7F] = &MMU::writeIF;
+  for (u16 addr = LCDC; addr <= WX; addr++) {
+    ioWrites[addr & 0x7F] = &MMU::writeGPU;
   }
+  ioReads[STAT & 0x7F] = &MMU::readGPU;
+  ioReads[LY & 0x7F] = &MMU::readGPU;
+  ioWrites[DMA & 0x7F] = &MMU::writeDMA;
+  ioWrites[0xFF50 & 0x7F] = &MMU::writeIgnored;
+}
 
-  // DMA
-  else if (addr == DMA) {
-    memory[0xFF46] = value;
-    dma(value);
-  }
+// Joypad class handles its register
+u8 MMU::readJoypad(u16 addr) { return joypad->read(memory[addr]); }
+void MMU::writeJoypad(u16 addr, u8 value) {
+  memory[addr] = joypad->read(value);
+}
 
-  // Unmap bootrom
-  else if (addr == 0xFF50) {
-    return;
-  }
+// DIV and TIMA are worked out when read; writes to DIV reset it to zero
+u8 MMU::readTimer(u16 addr) { return timer->read(addr); }
+void MMU::writeTimer(u16 addr, u8 value) { timer->write(addr, value); }
 
-  // Default
-  else {
-    memory[addr] = value;
-  }
+// CPU IF always polls high on bits 5-7
+void MMU::writeIF(u16 addr, u8 value) {
+  memory[addr] = value | 0xE0;
+  updatePending();
+}
+
+// STAT and LY are worked out by the GPU when read
+u8 MMU::readGPU(u16 addr) { return gpu->read(addr); }
+void MMU::writeGPU(u16 addr, u8 value) { gpu->write(addr, value); }
+
+void MMU::writeDMA(u16 addr, u8 value) {
+  memory[addr] = value;
+  dma(value);
+}
+
+// Unmapping the bootrom; there isn't one
+void MMU::writeIgnored(u16, u8) {}
+
+// Set bit interrupt of IF
+void MMU::requestInterrupt(u8 interrupt) {
+  bitSet(memory[IF], interrupt);
+  updatePending();
 }
 
 void MMU::write16(u16 addr, u16 value) {
@@ -183,11 +310,112 @@ void MMU::write16(u16 addr, u16 value) {
   write8(addr + 1, ((value & 0xFF00) >> 8));
 }
 
+// Is [addr, addr + n) inside [lo, hi)?
+static bool within(u16 addr, u32 n, u32 lo, u32 hi) {
+  return addr >= lo && addr + n <= hi;
+}
+
+// n bytes from addr as read8() sees them, or nullptr if that isn't a plain
+// run of bytes
+const u8 *MMU::readable(u16 addr, u32 n) {
+  if (dmaActive && addr < 0xFF00) {
+    return nullptr;
+  }
+  if (within(addr, n, 0x0000, 0x4000) || within(addr, n, 0x4000, 0x8000)) {
+    u32 offset = (addr < 0x4000 ? mbc.rom0Offset : mbc.romOffset) +
+                 (addr & 0x3FFF);
+    return offset + n <= romSize ? &rom[offset] : nullptr;
+  }
+  if (within(addr, n, 0x8000, 0xA000) || within(addr, n, 0xC000, 0xE000) ||
+      within(addr, n, 0xFE00, 0xFF00) || within(addr, n, 0xFF80, 0xFFFF)) {
+    return &memory[addr];
+  }
+  return nullptr;
+}
+
+// n bytes from addr that write8() stores as they are, or nullptr
+u8 *MMU::writable(u16 addr, u32 n) {
+  if (dmaActive && addr < 0xFF00) {
+    return nullptr;
+  }
+  if (!within(addr, n, 0x8000, 0xA000) && !within(addr, n, 0xC000, 0xE000) &&
+      !within(addr, n, 0xFE00, 0xFF00) && !within(addr, n, 0xFF80, 0xFFFF)) {
+    return nullptr;
+  }
+  if (std::find(codeMap.begin() + addr, codeMap.begin() + addr + n, 1) !=
+      codeMap.begin() + addr + n) {
+    return nullptr;
+  }
+  return &memory[addr];
+}
+
+bool MMU::copy(u16 dst, u16 src, u32 n) {
+  const u8 *from = readable(src, n);
+  u8 *to = writable(dst, n);
+  if (!from || !to) {
+    return false;
+  }
+  // Copying forwards onto itself repeats the start, which memmove doesn't
+  if (from == &memory[src] && dst > src && dst < src + n) {
+    return false;
+  }
+  memmove(to, from, n);
+  return true;
+}
+
+bool MMU::fill(u16 dst, u8 value, u32 n) {
+  u8 *to = writable(dst, n);
+  if (!to) {
+    return false;
+  }
+  memset(to, value, n);
+  return true;
+}
+
 // Source addr is: (data that was being written to FF46) / 100 or
 // equivalently, data << 8 Destination is: sprite RAM FE00-FE9F, 0xA0 bytes
+// The transfer takes 160 M-cycles, after a 1 M-cycle delay. Nothing the CPU
+// can do in the meantime changes the source, so it's all copied up front.
 void MMU::dma(u16 src) {
   src <<= 8;
-  for (u8 i = 0; i < 0xA0; i++) {
-    memory[OAM_ATTRIB + i] = memory[src + i];
+  if (src >= 0xE000) {
+    src -= 0x2000;  // E0-FF read the WRAM they shadow
+  }
+  dmaActive = false;  // writing DMA again restarts the transfer
+  const u8 *from = readable(src, 0xA0);
+  if (from) {
+    memcpy(&memory[OAM_ATTRIB], from, 0xA0);
+  } else {
+    for (u8 i = 0; i < 0xA0; i++) {
+      memory[OAM_ATTRIB + i] = read8(src + i);
+    }
   }
-}
\ No newline at end of file
+  dmaActive = true;
+  mapPages();
+  scheduler->schedule(Scheduler::DMA, scheduler->now + accessOffset + 4 + 640);
+}
+
+void MMU::endDMA() {
+  dmaActive = false;
+  mapPages();
+}
+
+// The CPU decoded [addr, addr + n) from RAM: writes there have to go through
+// writeHandler() to catch self-modifying code
+void MMU::markCode(u16 addr, u32 n) {
+  std::fill_n(codeMap.begin() + addr, n, 1);
+  for (u32 page = addr >> 8; page <= (addr + n - 1u) >> 8; page++) {
+    codePages[page] = true;
+    writePages[page] = nullptr;
+  }
+}
+
+// Self-modifying code: a write hit RAM the CPU has decoded, so every block
+// decoded from RAM has to go.
+void MMU::invalidateCode() {
+  std::fill(codeMap.begin(), codeMap.end(), 0);
+  std::fill_n(codePages, 256, false);
+  ramCodeGeneration++;
+  codeGeneration++;
+  mapPages();
+}
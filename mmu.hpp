@@ -7,45 +7,157 @@
 #ifndef GB_MMU
 #define GB_MMU
 
-#include <fstream>
+#include <memory>
+#include <string>
 #include <vector>
 #include "common.hpp"
 #include "joypad.hpp"
+#include "mbc.hpp"
+#include "ram.hpp"
+#include "rom.hpp"
+
+class GPU;
+class Scheduler;
+class Timer;
 
 class MMU
 {
 public:
-  struct MBC
-  {
-    u8 type;
-    u8 romBank;
-    u16 romOffset;
-    u16 ramOffset;
-    u8 mode;
-  } mbc;
+  MBC mbc;
 
   std::vector<u8> memory;
   std::vector<u8> bios;
-  std::vector<u8> rom;
-  std::vector<u8> ram; // External RAM
+  ExternalRAM ram;
+
+  // The cartridge ROM, shared with every other MMU that loaded the same file.
+  // rom and romSize are its bytes, kept here for the read paths.
+  std::shared_ptr<const ROM> cartridge;
+  const u8 *rom;
+  u32 romSize;
 
   MMU();
 
-  bool load(char *filename);
-  char *romFilename;
+  // Load a ROM. Battery-backed RAM is loaded from and saved to
+  // saveFilename; without one, it starts zeroed and isn't saved.
+  bool load(char *filename, const char *saveFilename = nullptr);
+  void load(std::shared_ptr<const ROM> cartridge,
+            const char *saveFilename = nullptr);
+  char *romFilename;  // nullptr if the ROM didn't come from a file
+  std::string saveFilename;
 
   void reset();
 
-  u8 read8(u16 address);
+  // Start saving battery-backed RAM written since the last call. Called once
+  // a frame; the rest is saved when the MMU goes or loads another ROM.
+  void syncRAM();
+
+  // Pages of plain memory are read and written through readPages and
+  // writePages; the rest go to readHandler() and writeHandler().
+  u8 read8(u16 address) {
+    const u8 *page = readPages[address >> 8];
+    return page ? page[address & 0xFF] : readHandler(address);
+  }
   u16 read16(u16 address);
-  void write8(u16 address, u8 value);
+  u8 fetch8(u16 address);
+  void write8(u16 address, u8 value) {
+    u8 *page = writePages[address >> 8];
+    if (page) {
+      page[address & 0xFF] = value;
+    } else {
+      writeHandler(address, value);
+    }
+  }
   void write16(u16 address, u16 value);
 
+  // The same as n write8()s at increasing addresses from dst, of the bytes
+  // read8() reads from src or of value. Only for plain memory: ROM, VRAM,
+  // WRAM, OAM or HRAM to VRAM, WRAM, OAM or HRAM, not holding decoded code.
+  // Anything else returns false without doing a thing.
+  bool copy(u16 dst, u16 src, u32 n);
+  bool fill(u16 dst, u8 value, u32 n);
+
   // Joypad class handles reads/writes to its register
   Joypad *joypad;
 
+  // Set by any write to I/O registers or IE, which can change when the next
+  // event is or make an interrupt pending, so the main loop stops running the
+  // CPU ahead and handles events.
+  bool ioWritten;
+
+  // GPU class handles the LCD registers other than DMA
+  GPU *gpu;
+
+  // Timer class handles DIV, TIMA, TMA and TAC
+  Timer *timer;
+
+  // For the DMA event
+  Scheduler *scheduler;
+
+  // Set while OAM DMA runs. Writing DMA copies the 0xA0 bytes to OAM at
+  // once, then keeps the CPU off the buses the transfer uses, everything
+  // below the I/O registers, for the 160 M-cycles it takes. The DMA event
+  // calls endDMA().
+  bool dmaActive;
+  void endDMA();
+
+  // Cycles from the start of the instruction being run to its memory access,
+  // which the timer and GPU add to Scheduler::now. Set by CPU::execute() in
+  // accurate builds only; always 0 otherwise.
+  u32 accessOffset;
+
+  // IF & IE & 0x1F, the interrupts that are requested and enabled. write8()
+  // and requestInterrupt() keep it up to date; anything else changing IF or
+  // IE in memory calls updatePending().
+  u8 pending;
+  void requestInterrupt(u8 interrupt);
+  void updatePending() { pending = memory[IF] & memory[IE] & 0x1F; }
+
+  // Block cache support. codeMap marks the bytes of RAM the CPU has decoded;
+  // writing one of them bumps ramCodeGeneration, and loading a ROM bumps
+  // romCodeGeneration. codeGeneration is bumped by both and by ROM bank
+  // switches, so the CPU only has to compare one counter per instruction.
+  std::vector<u8> codeMap;
+  u32 codeGeneration;
+  u32 romCodeGeneration;
+  u32 ramCodeGeneration;
+  void markCode(u16 addr, u32 n);
+
 private:
+  // Host memory for each 256-byte page of the address space, or nullptr for
+  // pages that need a handler: I/O and HRAM, MBC control, echo RAM writes,
+  // banks past the end of rom or ram, RAM holding decoded code and anything
+  // OAM DMA locks out. mapPages() rebuilds them, mapBanks() just the switched
+  // ROM and RAM banks.
+  const u8 *readPages[256];
+  u8 *writePages[256];
+  bool codePages[256];  // pages with bytes set in codeMap
+  void mapCartridge();
+  void mapPages();
+  void mapBanks();
+  u8 readHandler(u16 addr);
+  u8 readCartRAM(u16 addr);
+  void writeHandler(u16 addr, u8 value);
+
+  // Handlers for FF00-FF7F, by addr & 0x7F. nullptr is plain memory.
+  typedef u8 (MMU::*ioRead)(u16 addr);
+  typedef void (MMU::*ioWrite)(u16 addr, u8 value);
+  ioRead ioReads[0x80];
+  ioWrite ioWrites[0x80];
+  void mapIO();
+  u8 readJoypad(u16 addr);
+  void writeJoypad(u16 addr, u8 value);
+  u8 readTimer(u16 addr);
+  void writeTimer(u16 addr, u8 value);
+  void writeIF(u16 addr, u8 value);
+  u8 readGPU(u16 addr);
+  void writeGPU(u16 addr, u8 value);
+  void writeDMA(u16 addr, u8 value);
+  void writeIgnored(u16 addr, u8 value);
+
   void dma(u16 src);
+  void invalidateCode();
+  const u8 *readable(u16 addr, u32 n);
+  u8 *writable(u16 addr, u32 n);
 };
 
 #endif
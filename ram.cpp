@@ -0,0 +1,142 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: ram.cpp
+// Description: Cartridge external RAM, saved to a .sav file
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include "ram.hpp"
+
+ExternalRAM::ExternalRAM() : fd(-1), anyDirty(false), failing(false) {}
+
+ExternalRAM::~ExternalRAM() { close(); }
+
+void ExternalRAM::open(const char *filename, u32 size) {
+  if (filename && this->filename == filename && buffer.size() == size) {
+    return;
+  }
+  close();
+  buffer.assign(size, 0);
+  if (!filename || !size) {
+    return;
+  }
+  this->filename = filename;
+
+  // A short or new file reads as zeroes past its end, and is grown so that
+  // later writes can't run out of space
+  fd = ::open(filename, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    report("open");
+    return;
+  }
+  u32 done = 0;
+  while (done < size) {
+    ssize_t n = pread(fd, &buffer[done], size - done, done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      report("read");
+      stop();
+      return;
+    }
+    if (n == 0) {
+      break;
+    }
+    done += n;
+  }
+  if (done < size && ftruncate(fd, size) != 0) {
+    report("grow");
+    stop();
+    return;
+  }
+  dirty.assign((size + 0xFF) >> 8, false);
+}
+
+void ExternalRAM::close() {
+  if (fd >= 0) {
+    sync();
+    if (anyDirty) {
+      printf("RAM: %s is missing the last writes\n", filename.c_str());
+    }
+    if (fsync(fd) != 0) {
+      report("flush");
+    }
+    stop();
+  }
+  filename.clear();
+  buffer.clear();
+}
+
+void ExternalRAM::mark(u32 offset) {
+  dirty[offset >> 8] = true;
+  anyDirty = true;
+}
+
+// Each run of marked pages is written into the page cache; the OS gets it to
+// the disk without us waiting. A run that can't be written stays marked, to
+// be tried again next time.
+bool ExternalRAM::sync() {
+  if (!anyDirty) {
+    return false;
+  }
+  bool written = false;
+  bool failed = false;
+  u32 pages = dirty.size();
+  for (u32 page = 0; page < pages; page++) {
+    if (!dirty[page]) {
+      continue;
+    }
+    u32 start = page;
+    while (page < pages && dirty[page]) {
+      page++;
+    }
+    if (!write(start << 8, std::min<u32>(page << 8, buffer.size()))) {
+      failed = true;
+      continue;
+    }
+    std::fill(dirty.begin() + start, dirty.begin() + page, false);
+    written = true;
+  }
+  anyDirty = failed;
+
+  // Say so once per run of failures, not every frame
+  if (failed && !failing) {
+    report("write");
+  }
+  failing = failed;
+  return written;
+}
+
+// buffer[from, to) to the file, however many writes it takes
+bool ExternalRAM::write(u32 from, u32 to) {
+  while (from < to) {
+    ssize_t n = pwrite(fd, &buffer[from], to - from, from);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    from += n;
+  }
+  return true;
+}
+
+void ExternalRAM::report(const char *what) {
+  printf("RAM: can't %s %s: %s\n", what, filename.c_str(), strerror(errno));
+}
+
+// Keep the RAM, but don't save it any more
+void ExternalRAM::stop() {
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+  dirty.clear();
+  anyDirty = false;
+  failing = false;
+}
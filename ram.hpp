@@ -0,0 +1,59 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: ram.hpp
+// Description: Cartridge external RAM, saved to a .sav file
+//
+// Battery-backed RAM is read from its save file into memory of its own, so
+// two emulators given the same file never see each other's writes. To save
+// without doing I/O per write or rewriting the whole file, the MMU marks the
+// 256-byte pages the game writes to, and sync() writes just those back once
+// a frame.
+
+#ifndef GB_RAM
+#define GB_RAM
+
+#include <string>
+#include <vector>
+#include "common.hpp"
+
+class ExternalRAM {
+ public:
+  ExternalRAM();
+  ~ExternalRAM();
+
+  ExternalRAM(const ExternalRAM &) = delete;
+  ExternalRAM &operator=(const ExternalRAM &) = delete;
+
+  // size bytes of RAM. With a filename, it's loaded from that file, which is
+  // created if need be, and kept as it is if it's already open. Without one
+  // it's zeroed memory that isn't saved. Errors are reported, and saving
+  // stops if the file can't be opened, read or grown.
+  void open(const char *filename, u32 size);
+
+  // Save what's left to write and close the file
+  void close();
+
+  u8 &operator[](u32 offset) { return buffer[offset]; }
+  u32 size() const { return buffer.size(); }
+
+  // The page at offset hasn't been written to since the last sync(), so
+  // a write has to mark() it. Never true for RAM that isn't saved.
+  bool clean(u32 offset) const { return fd >= 0 && !dirty[offset >> 8]; }
+  void mark(u32 offset);
+
+  // Write the marked pages to the file and clear their marks. Returns true
+  // if any were written. Pages that couldn't be are left marked.
+  bool sync();
+
+ private:
+  std::vector<u8> buffer;
+  int fd;  // the save file, or -1 if it isn't being saved
+  std::string filename;
+  std::vector<bool> dirty;
+  bool anyDirty;
+  bool failing;  // the last sync() couldn't write everything
+  bool write(u32 from, u32 to);
+  void report(const char *what);
+  void stop();
+};
+
+#endif
@@ -0,0 +1,98 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: rom.cpp
+// Description: Read-only cartridge ROM images
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <map>
+#include <mutex>
+#include <utility>
+#include "rom.hpp"
+
+namespace {
+
+// ROMs that are open, by device and inode so that different paths to the
+// same file share too. The size and modification time are checked as well,
+// in case the file has been rewritten since it was mapped.
+struct openROM {
+  std::weak_ptr<const ROM> rom;
+  off_t size;
+  time_t modified;
+};
+typedef std::pair<dev_t, ino_t> fileID;
+
+std::mutex openLock;
+std::map<fileID, openROM> opened;
+
+}  // namespace
+
+std::shared_ptr<const ROM> ROM::open(const char *filename) {
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+    close(fd);
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(openLock);
+  fileID id(info.st_dev, info.st_ino);
+  auto found = opened.find(id);
+  if (found != opened.end()) {
+    std::shared_ptr<const ROM> rom = found->second.rom.lock();
+    if (rom && found->second.size == info.st_size &&
+        found->second.modified == info.st_mtime) {
+      close(fd);
+      return rom;
+    }
+  }
+
+  // Map the file, or read it if it can't be mapped (it's empty, or on a
+  // filesystem without mmap())
+  std::shared_ptr<ROM> rom(new ROM());
+  rom->length = info.st_size;
+  void *map = MAP_FAILED;
+  if (rom->length) {
+    map = mmap(nullptr, rom->length, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  if (map != MAP_FAILED) {
+    rom->bytes = (const u8 *)map;
+    rom->mapped = true;
+  } else {
+    rom->buffer.resize(rom->length);
+    u32 done = 0;
+    while (done < rom->length) {
+      ssize_t n = pread(fd, &rom->buffer[done], rom->length - done, done);
+      if (n <= 0) {
+        break;
+      }
+      done += n;
+    }
+    rom->buffer.resize(done);
+    rom->length = done;
+    rom->bytes = rom->buffer.data();
+  }
+  close(fd);
+
+  // Forget ROMs nobody has open any more while we're here
+  for (auto i = opened.begin(); i != opened.end();) {
+    i = i->second.rom.expired() ? opened.erase(i) : std::next(i);
+  }
+  opened[id] = {rom, info.st_size, info.st_mtime};
+  return rom;
+}
+
+ROM::ROM(std::vector<u8> bytes) : buffer(std::move(bytes)) {
+  this->bytes = buffer.data();
+  length = buffer.size();
+}
+
+ROM::~ROM() {
+  if (mapped) {
+    munmap((void *)bytes, length);
+  }
+}
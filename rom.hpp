@@ -0,0 +1,40 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: rom.hpp
+// Description: Read-only cartridge ROM images
+//
+// ROM files are mapped with mmap() rather than read, and every MMU that loads
+// the same file shares one mapping: open() hands out references to the ROM
+// that's already open, and the mapping goes when the last of them does.
+
+#ifndef GB_ROM
+#define GB_ROM
+
+#include <memory>
+#include <vector>
+#include "common.hpp"
+
+class ROM {
+ public:
+  // The ROM in filename, or nullptr if it can't be opened
+  static std::shared_ptr<const ROM> open(const char *filename);
+
+  // A ROM held in memory, for built-in programs
+  explicit ROM(std::vector<u8> bytes);
+  ~ROM();
+
+  ROM(const ROM &) = delete;
+  ROM &operator=(const ROM &) = delete;
+
+  const u8 *data() const { return bytes; }
+  u32 size() const { return length; }
+
+ private:
+  ROM() = default;
+
+  const u8 *bytes = nullptr;
+  u32 length = 0;
+  bool mapped = false;     // bytes is our mmap() of the file
+  std::vector<u8> buffer;  // otherwise bytes points here
+};
+
+#endif
@@ -0,0 +1,54 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: scheduler.cpp
+// Description: Cycle-based event scheduler
+//
+// Rescheduling or cancelling an event doesn't search the heap; it bumps the
+// event's generation and the old entry is dropped when it reaches the top.
+
+#include <algorithm>
+#include "scheduler.hpp"
+
+Scheduler::Scheduler() { reset(); }
+
+void Scheduler::reset() {
+  now = 0;
+  heap.clear();
+  std::fill_n(generation, EVENTS, 0);
+}
+
+void Scheduler::schedule(event e, u64 at) {
+  heap.push_back({at, (u32)e, ++generation[e]});
+  std::push_heap(heap.begin(), heap.end(), later);
+}
+
+void Scheduler::cancel(event e) { generation[e]++; }
+
+u64 Scheduler::next() {
+  discard();
+  return heap.empty() ? NEVER : heap.front().at;
+}
+
+bool Scheduler::pop(event &e) {
+  discard();
+  if (heap.empty() || heap.front().at > now) {
+    return false;
+  }
+  e = (event)heap.front().e;
+  std::pop_heap(heap.begin(), heap.end(), later);
+  heap.pop_back();
+  return true;
+}
+
+// Heap order: earliest cycle first, ties in event order
+bool Scheduler::later(const entry &a, const entry &b) {
+  return a.at != b.at ? a.at > b.at : a.e > b.e;
+}
+
+// Drop replaced and cancelled entries off the top of the heap
+void Scheduler::discard() {
+  while (!heap.empty() &&
+         heap.front().generation != generation[heap.front().e]) {
+    std::pop_heap(heap.begin(), heap.end(), later);
+    heap.pop_back();
+  }
+}
@@ -0,0 +1,55 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: scheduler.hpp
+// Description: Cycle-based event scheduler
+//
+// Keeps the absolute cycle at which each subsystem next needs attention in a
+// min-heap. The main loop lets the CPU run freely up to the earliest one
+// instead of stepping everything after every instruction.
+
+#ifndef GB_SCHEDULER
+#define GB_SCHEDULER
+
+#include <vector>
+#include "common.hpp"
+
+class Scheduler {
+ public:
+  Scheduler();
+  void reset();
+
+  enum event {
+    PPU,    // the PPU changes mode, see GPU::sync()
+    TIMER,  // TIMA overflows, see Timer::overflow()
+    DMA,    // OAM DMA finishes, see MMU::endDMA()
+    EVENTS
+  };
+
+  // Master clock: T-cycles since reset, advanced by the main loop after
+  // each instruction or run of compiled code. Subsystems remember the cycle
+  // they were last brought up to date at and catch up from there.
+  u64 now;
+
+  // Have e happen at cycle at, replacing any earlier schedule of it
+  void schedule(event e, u64 at);
+  void cancel(event e);
+
+  // Cycle of the earliest pending event, or NEVER if there is none
+  static const u64 NEVER = ~0ULL;
+  u64 next();
+
+  // Take the earliest pending event if it is due. Returns false if none is.
+  bool pop(event &e);
+
+ private:
+  struct entry {
+    u64 at;
+    u32 e;
+    u32 generation;
+  };
+  std::vector<entry> heap;  // earliest first, see later()
+  u32 generation[EVENTS];   // entries from an older generation are stale
+  static bool later(const entry &a, const entry &b);
+  void discard();
+};
+
+#endif
@@ -0,0 +1,44 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: superinstructions.hpp
+// Description: Instruction pairs with fused handlers
+//
+// X(op1, op2) for each pair CPU::execute() can run as one instruction. This
+// default covers the usual copy, count and polling loops; build gb_profile
+// and run it on a ROM to regenerate the list from the pairs that ROM runs
+// most (see readme.md). Build with GB_NO_SUPERINSTRUCTIONS to leave them out;
+// GB_ACCURATE builds leave them out too.
+
+#ifndef GB_SUPERINSTRUCTIONS
+#define GB_SUPERINSTRUCTIONS
+
+#if defined(GB_NO_SUPERINSTRUCTIONS) || defined(GB_ACCURATE)
+#define GB_FUSED_PAIRS(X)
+#else
+#define GB_FUSED_PAIRS(X)                                   \
+  X(0x2A, 0x12) /* LDI A, (HL) / LD (DE), A */              \
+  X(0x1A, 0x22) /* LD A, (DE) / LDI (HL), A */              \
+  X(0x1A, 0x13) /* LD A, (DE) / INC DE */                   \
+  X(0x7E, 0x23) /* LD A, (HL) / INC HL */                   \
+  X(0x13, 0x0B) /* INC DE / DEC BC */                       \
+  X(0x0B, 0x78) /* DEC BC / LD A, B */                      \
+  X(0x78, 0xB1) /* LD A, B / OR C */                        \
+  X(0xB1, 0x20) /* OR C / JR NZ, n */                       \
+  X(0x05, 0x20) /* DEC B / JR NZ, n */                      \
+  X(0x0D, 0x20) /* DEC C / JR NZ, n */                      \
+  X(0x3D, 0x20) /* DEC A / JR NZ, n */                      \
+  X(0xFE, 0x20) /* CP n / JR NZ, n */                       \
+  X(0xFE, 0x28) /* CP n / JR Z, n */                        \
+  X(0xFE, 0x30) /* CP n / JR NC, n */                       \
+  X(0xFE, 0x38) /* CP n / JR C, n */                        \
+  X(0xE6, 0x20) /* AND n / JR NZ, n */                      \
+  X(0xE6, 0x28) /* AND n / JR Z, n */                       \
+  X(0xA7, 0x28) /* AND A / JR Z, n */                       \
+  X(0xB7, 0x28) /* OR A / JR Z, n */                        \
+  X(0xF0, 0xFE) /* LDH A, (n) / CP n */                     \
+  X(0xF0, 0xE6) /* LDH A, (n) / AND n */                    \
+  X(0xF0, 0xA7) /* LDH A, (n) / AND A */                    \
+  X(0xAF, 0xE0) /* XOR A / LDH (n), A */                    \
+  X(0x3E, 0xE0) /* LD A, n / LDH (n), A */
+#endif
+
+#endif
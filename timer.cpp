@@ -0,0 +1,133 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: timer.cpp
+// Description: DIV and TIMA, computed from a system counter on demand
+
+#include "timer.hpp"
+
+/*
+FF04 - DIV - Divider Register (R/W)
+This register is incremented at rate of 16384Hz. Writing any value to this
+register resets it to 00h.
+
+FF05 - TIMA - Timer counter (R/W)
+This timer is incremented by a clock frequency specified by the TAC register
+($FF07). When the value overflows (gets bigger than FFh) then it will be reset
+to the value specified in TMA (FF06), and an interrupt will be requested, as
+described below.
+
+FF06 - TMA - Timer Modulo (R/W)
+When the TIMA overflows, this data will be loaded.
+
+FF07 - TAC - Timer Control (R/W)
+ Bit  2   - Timer Enable
+ Bits 1-0 - Input Clock Select
+            00: CPU Clock / 1024 (DMG, CGB:   4096 Hz, SGB:   ~4194 Hz)
+            01: CPU Clock / 16   (DMG, CGB: 262144 Hz, SGB: ~268400 Hz)
+            10: CPU Clock / 64   (DMG, CGB:  65536 Hz, SGB:  ~67110 Hz)
+            11: CPU Clock / 256  (DMG, CGB:  16384 Hz, SGB:  ~16780 Hz)*/
+
+Timer::Timer() {}
+
+void Timer::reset() {
+  divBase = scheduler->now - 0xABCC;  // DMG system counter after the boot ROM
+  syncedAt = scheduler->now;
+  polled = false;
+  mmu->memory[TIMA] = 0;
+  mmu->memory[TMA] = 0;
+  mmu->memory[TAC] = 0;
+  scheduler->cancel(Scheduler::TIMER);
+}
+
+u64 Timer::clock() {
+  if constexpr (Accuracy::memoryTiming) {
+    return scheduler->now + mmu->accessOffset;
+  }
+  return scheduler->now;
+}
+
+u32 Timer::counter() { return (clock() - divBase) & 0xFFFF; }
+
+bool Timer::enabled() { return bitTest(mmu->memory[TAC], 2); }
+
+u32 Timer::period() {
+  static const u32 periods[4] = {1024, 16, 64, 256};
+  return periods[mmu->memory[TAC] & 3];
+}
+
+u8 Timer::read(u16 addr) {
+  polled = true;
+  if (addr == DIV) {
+    return counter() >> 8;
+  }
+  sync();
+  return mmu->memory[TIMA];
+}
+
+// TIMA counts falling edges of the selected counter bit, so resetting the
+// counter or changing TAC while that bit is set counts as an increment.
+void Timer::write(u16 addr, u8 value) {
+  sync();
+  bool before = enabled() && (counter() & (period() >> 1));
+  switch (addr) {
+    case DIV:
+      divBase = clock();
+      break;
+    case TIMA:
+      mmu->memory[TIMA] = value;
+      break;
+    case TMA:
+      mmu->memory[TMA] = value;
+      break;
+    case TAC:
+      mmu->memory[TAC] = value | 0xF8;
+      break;
+  }
+  bool after = enabled() && (counter() & (period() >> 1));
+  if (before && !after) {
+    if (mmu->memory[TIMA] == 0xFF) {
+      mmu->memory[TIMA] = mmu->memory[TMA];
+      mmu->requestInterrupt(2);
+    } else {
+      mmu->memory[TIMA]++;
+    }
+  }
+  schedule();
+}
+
+void Timer::overflow() {
+  sync();
+  schedule();
+}
+
+// Add the increments since syncedAt to TIMA, reloading it from TMA and
+// requesting the interrupt if it overflowed
+// todo: the reload and interrupt really come 4 cycles after the overflow
+void Timer::sync() {
+  u64 now = clock();
+  if (enabled()) {
+    u32 p = period();
+    u64 ticks = (now - divBase) / p - (syncedAt - divBase) / p;
+    u32 tima = mmu->memory[TIMA];
+    if (ticks >= 0x100 - tima) {
+      ticks -= 0x100 - tima;
+      u32 tma = mmu->memory[TMA];
+      tima = tma + ticks % (0x100 - tma);
+      mmu->requestInterrupt(2);
+    } else {
+      tima += ticks;
+    }
+    mmu->memory[TIMA] = tima;
+  }
+  syncedAt = now;
+}
+
+// Schedule the TIMER event for the increment that overflows TIMA
+void Timer::schedule() {
+  if (!enabled()) {
+    scheduler->cancel(Scheduler::TIMER);
+    return;
+  }
+  u64 p = period();
+  u64 edges = (clock() - divBase) / p + (0x100 - mmu->memory[TIMA]);
+  scheduler->schedule(Scheduler::TIMER, divBase + edges * p);
+}
@@ -0,0 +1,50 @@
+// gb: a Gameboy Emulator by Don Freiday
+// File: timer.hpp
+// Description: DIV and TIMA, computed from a system counter on demand
+//
+// DIV is the top byte of a 16-bit counter that runs at the CPU clock, and
+// TIMA counts falling edges of one of its bits (selected by TAC). Neither is
+// stepped: DIV is worked out from the cycles since the counter was last
+// reset, TIMA is brought up to date when it is read or written, and its next
+// overflow is a Scheduler event.
+
+#ifndef GB_TIMER
+#define GB_TIMER
+
+#include "accuracy.hpp"
+#include "common.hpp"
+#include "mmu.hpp"
+#include "scheduler.hpp"
+
+class Timer {
+ public:
+  Timer();
+  void reset();
+
+  MMU *mmu;
+  Scheduler *scheduler;
+
+  // DIV, TIMA, TMA and TAC accesses from the MMU
+  u8 read(u16 addr);
+  void write(u16 addr, u8 value);
+
+  // Handle the TIMER event: TIMA overflows now
+  void overflow();
+
+  // Set by reads of DIV and TIMA, which change without an event. CPU idle
+  // loop skipping clears it and won't skip a loop that reads them.
+  bool polled;
+
+ private:
+  u64 divBase;   // cycle the system counter was last 0 at
+  u64 syncedAt;  // cycle memory[TIMA] is correct at
+
+  u64 clock();    // cycle of the access being made, see MMU::accessOffset
+  u32 counter();  // system counter at clock()
+  bool enabled();
+  u32 period();  // cycles per TIMA increment
+  void sync();
+  void schedule();
+};
+
+#endif